@@ -0,0 +1,80 @@
+#include "ulisp.h"
+#include "../src/gc.c"
+#include "../src/data.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Compare cons throughput of slab allocator against plain malloc.
+ *
+ * Each round builds a list of LENGTH cells and drops it.
+ * "malloc" never frees cells as cons() did before, "malloc+free" frees the list explicitly.
+ */
+
+#define LENGTH 1000
+#define ROUNDS 10000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const struct sexp* __attribute__((noinline)) build_slab(const struct sexp* x, unsigned n) {
+    const struct sexp* xs = NIL();
+    while (n--) {
+        xs = cons(x, xs);
+    }
+    return xs;
+}
+
+static const struct sexp* __attribute__((noinline)) build_malloc(const struct sexp* x, unsigned n) {
+    const struct sexp* xs = NIL();
+    while (n--) {
+        struct pair* exp = malloc(sizeof(struct pair));
+        exp->fst = x;
+        exp->snd = xs;
+        xs = tag_pair(exp);
+    }
+    return xs;
+}
+
+static void free_malloc(const struct sexp* xs) {
+    while (!nil(xs)) {
+        const struct sexp* next = snd(xs);
+        free((void*) pair_of(xs));
+        xs = next;
+    }
+}
+
+int main() {
+    const struct sexp* x = symbol("x");
+    unsigned i;
+    double start, slab, leak, plain;
+
+    start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        build_slab(x, LENGTH);
+    }
+    slab = now() - start;
+
+    start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        build_malloc(x, LENGTH);
+    }
+    leak = now() - start;
+
+    start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        free_malloc(build_malloc(x, LENGTH));
+    }
+    plain = now() - start;
+
+    printf("slab:   %.1f Mcons/s\n", LENGTH * (double) ROUNDS / slab * 1e-6);
+    printf("malloc: %.1f Mcons/s (%.2fx)\n", LENGTH * (double) ROUNDS / leak * 1e-6, leak / slab);
+    printf("malloc+free: %.1f Mcons/s (%.2fx)\n", LENGTH * (double) ROUNDS / plain * 1e-6, plain / slab);
+    heap_report(stdout);
+    return 0;
+}
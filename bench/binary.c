@@ -0,0 +1,109 @@
+#include "ulisp.h"
+#include "../src/binary.c"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/read.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Throughput of writing and reading expressions in binary form, against text.
+ *
+ * Data is RECORDS quoted lists of symbols and numbers like `(row17 (x123 -42) (y7 : 1234567))`,
+ * written into memory and read back ROUNDS times by each path.
+ */
+
+#define RECORDS 20000
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const struct sexp* generate(jmp_buf trap) {
+    char* p;
+    size_t n;
+    FILE* fp = open_memstream(&p, &n);
+    unsigned i, j;
+    fprintf(fp, "(");
+    for (i = 0; i < RECORDS; ++i) {
+        fprintf(fp, "(row%u", i % 1000);
+        for (j = 0; j < 8; ++j) {
+            fprintf(fp, " (x%u %d) (y%u: %u)", (i + j) % 500, (int) (i * j) - 5000, j, i * 7919u);
+        }
+        fprintf(fp, ")");
+    }
+    fprintf(fp, ")");
+    fclose(fp);
+    struct source* source = string_source(p, n);
+    const struct sexp* data = read_source(trap, source);
+    close_source(source);
+    free(p);
+    return data;
+}
+
+int main() {
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror\n");
+        return 1;
+    }
+    const struct sexp* data = generate(trap);
+    double text_write = 0, text_read = 0, binary_write = 0, binary_read = 0;
+    size_t text_size = 0, binary_size = 0;
+    unsigned i;
+
+    for (i = 0; i < ROUNDS; ++i) {
+        const struct sexp* rest;
+        char* p;
+        double start;
+
+        start = now();
+        FILE* fp = open_memstream(&p, &text_size);
+        for (rest = data; !atom(rest); rest = snd(rest)) {
+            write(fp, fst(rest));
+            putc('\n', fp);
+        }
+        fclose(fp);
+        text_write += now() - start;
+
+        start = now();
+        struct source* source = string_source(p, text_size);
+        for (rest = data; !atom(rest); rest = snd(rest)) {
+            read_source(trap, source);
+        }
+        close_source(source);
+        text_read += now() - start;
+        free(p);
+
+        start = now();
+        fp = open_memstream(&p, &binary_size);
+        struct binary_output* out = open_binary_output(fp);
+        for (rest = data; !atom(rest); rest = snd(rest)) {
+            write_binary(out, fst(rest));
+        }
+        close_binary_output(out);
+        fclose(fp);
+        binary_write += now() - start;
+
+        start = now();
+        fp = fmemopen(p, binary_size, "r");
+        struct binary_input* in = open_binary_input(fp);
+        for (rest = data; !atom(rest); rest = snd(rest)) {
+            read_binary(trap, in);
+        }
+        close_binary_input(in);
+        fclose(fp);
+        binary_read += now() - start;
+        free(p);
+    }
+    printf("text:   %8zu bytes, write %6.1f ms, read %6.1f ms\n", text_size, text_write / ROUNDS * 1e3, text_read / ROUNDS * 1e3);
+    printf("binary: %8zu bytes, write %6.1f ms, read %6.1f ms\n", binary_size, binary_write / ROUNDS * 1e3, binary_read / ROUNDS * 1e3);
+    printf("binary is %.1fx faster to write, %.1fx faster to read\n", text_write / binary_write, text_read / binary_read);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/eval.c"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Measure time per function call as the number of top level definitions grows.
+ *
+ * `walk` recurses down a list of LENGTH cells, calling itself and looking up
+ * `walk`, `t`, `atom`... through the environment which has `globals` definitions
+ * made after `walk`.
+ */
+
+#define LENGTH 1000
+#define ROUNDS 1000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const struct sexp* list(unsigned n, const struct sexp** xs) {
+    return n ? cons(xs[0], list(n - 1, xs + 1)) : NIL();
+}
+
+/* (walk xs) ; => (cond ((atom xs) nil) (t (walk (cdr xs)))) */
+static const struct sexp* walk() {
+    const struct sexp* xs = symbol("xs");
+    const struct sexp* branch1 = list(2, (const struct sexp*[]){ list(2, (const struct sexp*[]){ symbol("atom"), xs }), NIL() });
+    const struct sexp* recur = list(2, (const struct sexp*[]){ symbol("walk"), list(2, (const struct sexp*[]){ symbol("cdr"), xs }) });
+    const struct sexp* branch2 = list(2, (const struct sexp*[]){ symbol("t"), recur });
+    const struct sexp* body = list(3, (const struct sexp*[]){ symbol("cond"), branch1, branch2 });
+    return list(3, (const struct sexp*[]){ symbol("lambda"), cons(xs, NIL()), body });
+}
+
+int main() {
+    static const unsigned globals[] = { 0, 100, 10000, 100000 };
+    jmp_buf trap;
+    unsigned i, j;
+
+    if (setjmp(trap)) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(globals) / sizeof(*globals); ++i) {
+        const struct sexp* env = cons(cons(symbol("t"), symbol("True")), NIL());
+        env = cons(cons(symbol("walk"), eval(trap, (struct env_exp){ env, walk() }).exp), env);
+        char name[32];
+        for (j = 0; j < globals[i]; ++j) {
+            snprintf(name, sizeof(name), "g%u", j);
+            env = cons(cons(symbol(name), NIL()), env);
+        }
+        const struct sexp* xs = NIL();
+        for (j = 0; j < LENGTH; ++j) {
+            xs = cons(NIL(), xs);
+        }
+        const struct sexp* call = list(2, (const struct sexp*[]){ symbol("walk"), list(2, (const struct sexp*[]){ symbol("quote"), xs }) });
+
+        const double start = now();
+        for (j = 0; j < ROUNDS; ++j) {
+            eval(trap, (struct env_exp){ env, call });
+        }
+        const double elapsed = now() - start;
+        printf("%6u globals: %.1f ns/call\n", globals[i], elapsed / ((LENGTH + 1) * (double) ROUNDS) * 1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/eval.c"
+#include "../src/read.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Startup from a prelude of DEFINITIONS lambdas, evaluated from text or mapped from heap image.
+ *
+ * Each round starts a new interpreter, which evaluates the prelude, or loads the image saved from it,
+ * and then calls one of the definitions; the image should take time of pages touched, not of the prelude.
+ */
+
+#define DEFINITIONS 2000
+#define ROUNDS 20
+#define IMAGE "/tmp/ulisp-bench-image.img"
+
+static char* prelude;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_prelude() {
+    size_t size;
+    FILE* fp = open_memstream(&prelude, &size);
+    unsigned i;
+    for (i = 0; i < DEFINITIONS; ++i) {
+        fprintf(fp, "(set (quote f%u) (lambda (xs n) (cond ((atom xs) (+ n %u)) (t (f%u (cdr xs) (+ n 1))))))\n", i, i, i);
+    }
+    fclose(fp);
+}
+
+/* environment of prelude evaluated from text. */
+static const struct sexp* evaluate(jmp_buf trap) {
+    struct source* source = string_source(prelude, strlen(prelude));
+    const struct sexp* volatile env = cons(cons(symbol("t"), symbol("True")), NIL());
+    jmp_buf trap2;
+    const int code = setjmp(trap2);
+    if (code == TRAP_NONE) {
+        while (true) {
+            env = eval(trap2, (struct env_exp){ env, read_source(trap2, source) }).env;
+        }
+    }
+    close_source(source);
+    if (code != TRAP_NOINPUT) {
+        longjmp(trap, code);
+    }
+    return env;
+}
+
+static const struct sexp* load(jmp_buf trap) {
+    const struct sexp* env;
+    if (!load_image(IMAGE, &env)) {
+        fprintf(stderr, "cannot load image\n");
+        exit(1);
+    }
+    return env;
+}
+
+static double measure(const char* name, const struct sexp* (*start)(jmp_buf trap)) {
+    jmp_buf trap;
+    unsigned i;
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror in %s\n", name);
+        exit(1);
+    }
+    const double begin = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        const struct sexp* env = start(trap);
+        const struct sexp* call = cons(symbol("f1999"), cons(cons(symbol("quote"), cons(cons(symbol("a"), NIL()), NIL())), cons(fixnum(0), NIL())));
+        eval(trap, (struct env_exp){ env, call });
+        release_interpreter();
+    }
+    const double seconds = (now() - begin) / ROUNDS;
+    printf("%-8s %8.3f ms per startup\n", name, seconds * 1e3);
+    return seconds;
+}
+
+int main() {
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror in prelude\n");
+        return 1;
+    }
+    make_prelude();
+    if (!save_image(IMAGE, evaluate(trap))) {
+        fprintf(stderr, "cannot write image\n");
+        return 1;
+    }
+    release_interpreter();
+    const double text = measure("text", evaluate);
+    const double image = measure("image", load);
+    printf("image is %.1fx faster\n", text / image);
+    remove(IMAGE);
+    free(prelude);
+    return 0;
+}
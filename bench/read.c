@@ -0,0 +1,101 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/read.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Parse throughput of reader in MB/s.
+ *
+ * Source is SIZE bytes of lists like `(set (quote x123) (lambda (x y) (cons x: y)))` with a long list at last,
+ * read from a mapped file, through buffer from stream, and from string.
+ */
+
+#define SIZE (16 << 20)
+#define ROUNDS 5
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char* generate(size_t* n) {
+    char* p;
+    FILE* fp = open_memstream(&p, n);
+    unsigned i = 0;
+    while (ftell(fp) < SIZE / 2) {
+        fprintf(fp, "(set (quote x%u) (lambda (x y) (cons x: y)))\n", i++ % 1000);
+    }
+    fprintf(fp, "(");
+    while (ftell(fp) < SIZE) {
+        fprintf(fp, "(item%u \\(escaped\\:name\\)) ", i++ % 1000);
+    }
+    fprintf(fp, ")\n");
+    fclose(fp);
+    return p;
+}
+
+/* read all expressions in source and return number of them. */
+static unsigned parse(struct source* source) {
+    jmp_buf trap;
+    volatile unsigned n = 0;
+    switch (setjmp(trap)) {
+    case TRAP_NONE:
+        while (true) {
+            read_source(trap, source);
+            n += 1;
+        }
+    case TRAP_NOINPUT:
+        return n;
+    default:
+        fprintf(stderr, "\nparse error\n");
+        exit(1);
+    }
+}
+
+int main() {
+    size_t n;
+    char* p = generate(&n);
+    FILE* fp = tmpfile();
+    fwrite(p, 1, n, fp);
+    fflush(fp);
+    unsigned i;
+    double mapped = 0, buffered = 0, string = 0;
+
+    for (i = 0; i < ROUNDS; ++i) {
+        double start;
+        struct source* source;
+
+        rewind(fp);
+        start = now();
+        source = open_source(fp);
+        parse(source);
+        close_source(source);
+        mapped += now() - start;
+
+        FILE* mem = fmemopen(p, n, "r");
+        start = now();
+        source = open_source(mem);
+        parse(source);
+        close_source(source);
+        buffered += now() - start;
+        fclose(mem);
+
+        start = now();
+        source = string_source(p, n);
+        parse(source);
+        close_source(source);
+        string += now() - start;
+    }
+    printf("mapped file: %.1f MB/s\n", n * (double) ROUNDS / mapped * 1e-6);
+    printf("buffered stream: %.1f MB/s\n", n * (double) ROUNDS / buffered * 1e-6);
+    printf("string: %.1f MB/s\n", n * (double) ROUNDS / string * 1e-6);
+    fclose(fp);
+    free(p);
+    return 0;
+}
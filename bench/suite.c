@@ -0,0 +1,246 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/eval.c"
+#include "../src/read.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/* unistd.h and sys/wait.h declare read and write, which clash with those of ulisp. */
+extern pid_t fork(void);
+extern pid_t wait4(pid_t pid, int* status, int options, struct rusage* usage);
+
+/*
+ * Standard workloads to track interpreter speed across versions.
+ *
+ * Each workload runs RUNS times, and each run repeats its op `iterations` times.
+ * Results are written to stdout as JSON: median and minimum of ns/op over runs,
+ * objects allocated per op, and peak RSS of a child process forked to run the workload alone.
+ * Names given as arguments select workloads to run.
+ *
+ * Lisp workloads evaluate the last expression of program as one op, in the environment
+ * made by the expressions before it, `t`, and `xs` bound to the list (0 1 ... 999).
+ */
+
+#define RUNS 5
+#define LENGTH 1000
+
+struct workload {
+    const char* name;
+    const char* program;
+    void (*prepare)(jmp_buf trap, const struct workload* workload);
+    void (*op)(jmp_buf trap);
+    unsigned iterations;
+};
+
+static void prepare_program(jmp_buf trap, const struct workload* workload);
+static void eval_program(jmp_buf trap);
+static void prepare_source(jmp_buf trap, const struct workload* workload);
+static void read_all(jmp_buf trap);
+static void prepare_tree(jmp_buf trap, const struct workload* workload);
+static void write_tree(jmp_buf trap);
+
+static const struct workload workloads[] = {
+    { "reverse",
+      "(set (quote r) (lambda (x y) (cond ((atom x) y) (t (r (cdr x) (cons (car x) y))))))"
+      "(r xs ())",
+      prepare_program, eval_program, 2000 },
+    { "map",
+      "(set (quote map) (lambda (f xs) (cond ((atom xs) xs) (t (cons (f (car xs)) (map f (cdr xs)))))))"
+      "(map (lambda (x) (+ x 1)) xs)",
+      prepare_program, eval_program, 1000 },
+    { "recursion",
+      "(set (quote deep) (lambda (n) (cond ((= n 0) 0) (t (+ 1 (deep (- n 1)))))))"
+      "(deep 5000)",
+      prepare_program, eval_program, 200 },
+    { "fib",
+      "(set (quote fib) (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))"
+      "(fib 20)",
+      prepare_program, eval_program, 20 },
+    { "closures",
+      "(set (quote adder) (lambda (a) (lambda (b) (lambda (c) (+ a (+ b c))))))"
+      "(set (quote sum) (lambda (xs n) (cond ((atom xs) n) (t (sum (cdr xs) (((adder n) (car xs)) 1))))))"
+      "(sum xs 0)",
+      prepare_program, eval_program, 1000 },
+    { "environment",
+      "(set (quote a) 1) (set (quote b) 2) (set (quote c) 3) (set (quote d) 4)"
+      "(set (quote walk) (lambda (xs) (set (quote n) (+ a (+ b (+ c d)))) (cond ((atom xs) n) (t (walk (cdr xs))))))"
+      "(walk xs)",
+      prepare_program, eval_program, 500 },
+    { "read", NULL, prepare_source, read_all, 20 },
+    { "print", NULL, prepare_tree, write_tree, 50 },
+};
+
+/* state of the workload being run; sexps are GC roots. */
+static struct {
+    const struct sexp* env;
+    const struct sexp* exp;
+    char* source;
+    size_t size;
+} state;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void prepare_program(jmp_buf trap, const struct workload* workload) {
+    const struct sexp* xs = NIL();
+    unsigned i;
+    for (i = LENGTH; i--;) {
+        xs = cons(fixnum(i), xs);
+    }
+    state.env = cons(cons(symbol("xs"), xs), cons(cons(symbol("t"), symbol("True")), NIL()));
+    struct source* in = string_source(workload->program, strlen(workload->program));
+    state.exp = read_source(trap, in);
+    while (true) {
+        jmp_buf eof;
+        if (setjmp(eof)) {
+            break;
+        }
+        const struct sexp* next = read_source(eof, in);
+        state.env = eval(trap, (struct env_exp){ state.env, state.exp }).env;
+        state.exp = next;
+    }
+    close_source(in);
+}
+
+void eval_program(jmp_buf trap) {
+    eval(trap, (struct env_exp){ state.env, state.exp });
+}
+
+/* about 1MB of definitions and a long list, like bench/read. */
+void prepare_source(jmp_buf trap, const struct workload* workload) {
+    FILE* fp = open_memstream(&state.source, &state.size);
+    unsigned i = 0;
+    while (ftell(fp) < (1 << 19)) {
+        fprintf(fp, "(set (quote x%u) (lambda (x y) (cons x: (+ y %u))))\n", i % 1000, i);
+        i += 1;
+    }
+    fprintf(fp, "(");
+    while (ftell(fp) < (1 << 20)) {
+        fprintf(fp, "(item%u %d) ", i % 1000, -(int) i);
+        i += 1;
+    }
+    fprintf(fp, ")\n");
+    fclose(fp);
+}
+
+void read_all(jmp_buf trap) {
+    struct source* source = string_source(state.source, state.size);
+    jmp_buf eof;
+    const int code = setjmp(eof);
+    if (code == TRAP_NONE) {
+        while (true) {
+            read_source(eof, source);
+        }
+    }
+    close_source(source);
+    if (code != TRAP_NOINPUT) {
+        longjmp(trap, code);
+    }
+}
+
+/* list of 10000 elements like (k (a 1) (b (c 2))). */
+void prepare_tree(jmp_buf trap, const struct workload* workload) {
+    const char item[] = "(k (a 1) (b (c 2)))";
+    struct source* source = string_source(item, sizeof(item) - 1);
+    const struct sexp* x = read_source(trap, source);
+    close_source(source);
+    unsigned i;
+    state.exp = NIL();
+    for (i = 0; i < 10000; ++i) {
+        state.exp = cons(x, state.exp);
+    }
+}
+
+void write_tree(jmp_buf trap) {
+    free(text(state.exp));
+}
+
+static int compare_double(const void* a, const void* b) {
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static void measure(jmp_buf trap, const struct workload* workload, bool first) {
+    double ns[RUNS];
+    unsigned i, j;
+    workload->prepare(trap, workload);
+    workload->op(trap); // warm up.
+    const size_t allocations = gc_stats().allocations;
+    for (i = 0; i < RUNS; ++i) {
+        const double start = now();
+        for (j = 0; j < workload->iterations; ++j) {
+            workload->op(trap);
+        }
+        ns[i] = (now() - start) * 1e9 / workload->iterations;
+    }
+    const double allocs = (double) (gc_stats().allocations - allocations) / RUNS / workload->iterations;
+    qsort(ns, RUNS, sizeof(*ns), compare_double);
+    printf("%s    {\"name\": \"%s\", \"iterations\": %u, \"runs\": %u, \"ns_per_op\": %.0f, \"ns_per_op_min\": %.0f, "
+           "\"allocs_per_op\": %.1f",
+           first ? "" : ",\n", workload->name, workload->iterations, RUNS, ns[RUNS / 2], ns[0], allocs);
+    fflush(stdout);
+}
+
+/* measure workload in a child process, then finish its result with the peak RSS of the child; return false if it fails. */
+static bool measure_apart(jmp_buf trap, const struct workload* workload, bool first) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "\ncannot fork\n");
+        return false;
+    } else if (pid == 0) {
+        measure(trap, workload, first);
+        exit(0);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || status != 0) { // status of exit(0).
+        return false;
+    }
+    printf(", \"peak_rss_kb\": %ld}", usage.ru_maxrss);
+    return true;
+}
+
+/* test whether workload is selected by args, or args select none (i.e. all). */
+static bool selected(const char* name, int argc, char* argv[]) {
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(name, argv[i])) {
+            return true;
+        }
+    }
+    return argc < 2;
+}
+
+int main(int argc, char* argv[]) {
+    jmp_buf trap;
+    unsigned i;
+    bool first = true;
+
+    gc_root(&state.env);
+    gc_root(&state.exp);
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror in workload\n");
+        return 1;
+    }
+    printf("{\"benchmarks\": [\n");
+    for (i = 0; i < sizeof(workloads) / sizeof(*workloads); ++i) {
+        if (selected(workloads[i].name, argc, argv)) {
+            if (!measure_apart(trap, workloads + i, first)) {
+                return 1; // reported by the child.
+            }
+            first = false;
+        }
+    }
+    printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/eval.c"
+#include "../src/read.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Throughput of interpreters run on separate threads.
+ *
+ * Each thread defines fib on its own interpreter and evaluates (fib 20) ROUNDS times.
+ * With no state shared, throughput should grow with number of threads up to cores.
+ * Numbers of threads may be given as arguments (default 1 2 4 8).
+ *
+ * Then (pmap fib xs 1) over 16 elements is compared with mapping them in turn (chunk of 16).
+ */
+
+#define ROUNDS 40
+
+static const char program[] =
+    "(set (quote fib) (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))"
+    "(fib 20)";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* work(void* arg) {
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror in thread\n");
+        exit(1);
+    }
+    struct source* source = string_source(program, strlen(program));
+    const struct sexp* env = cons(cons(symbol("t"), symbol("True")), NIL());
+    env = eval(trap, (struct env_exp){ env, read_source(trap, source) }).env;
+    const struct sexp* exp = read_source(trap, source);
+    close_source(source);
+    unsigned i;
+    for (i = 0; i < ROUNDS; ++i) {
+        eval(trap, (struct env_exp){ env, exp });
+    }
+    release_interpreter();
+    return NULL;
+}
+
+static void compare_pmap() {
+    static const char pmap[] =
+        "(set (quote xs) (quote (20 20 20 20 20 20 20 20 20 20 20 20 20 20 20 20)))"
+        "(pmap fib xs 16)"
+        "(pmap fib xs 1)";
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        fprintf(stderr, "\nerror in pmap\n");
+        exit(1);
+    }
+    struct source* source = string_source(program, strlen(program));
+    const struct sexp* env = cons(cons(symbol("t"), symbol("True")), NIL());
+    env = eval(trap, (struct env_exp){ env, read_source(trap, source) }).env;
+    close_source(source);
+    source = string_source(pmap, strlen(pmap));
+    env = eval(trap, (struct env_exp){ env, read_source(trap, source) }).env;
+    const struct sexp* sequential = read_source(trap, source);
+    const struct sexp* parallel = read_source(trap, source);
+    close_source(source);
+    double start = now();
+    eval(trap, (struct env_exp){ env, sequential });
+    const double seconds = now() - start;
+    start = now();
+    eval(trap, (struct env_exp){ env, parallel });
+    const double pmap_seconds = now() - start;
+    printf("pmap: %.1f ms in turn, %.1f ms in parallel (%.2fx)\n", seconds * 1e3, pmap_seconds * 1e3, seconds / pmap_seconds);
+}
+
+int main(int argc, char* argv[]) {
+    const char* defaults[] = { NULL, "1", "2", "4", "8" };
+    double base = 0;
+    int k;
+    if (argc < 2) {
+        argc = sizeof(defaults) / sizeof(*defaults);
+        argv = (char**) defaults;
+    }
+    for (k = 1; k < argc; ++k) {
+        const unsigned n = strtoul(argv[k], NULL, 10);
+        pthread_t threads[64];
+        unsigned i;
+        if (n < 1 || n > 64) {
+            fprintf(stderr, "threads must be 1 to 64: %s\n", argv[k]);
+            return 1;
+        }
+        const double start = now();
+        for (i = 0; i < n; ++i) {
+            pthread_create(threads + i, NULL, work, NULL);
+        }
+        for (i = 0; i < n; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        const double rate = n * ROUNDS / (now() - start);
+        if (k == 1) {
+            base = rate;
+        }
+        printf("%2u threads: %.0f evals/s (%.2fx)\n", n, rate, rate / base);
+    }
+    compare_pmap();
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "ulisp.h"
+#include "../src/data.c"
+#include "../src/text.c"
+#include "../src/eval.c"
+#include "../src/read.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Compare bytecode VM against tree walker on recursive functions.
+ *
+ * Each program defines functions, then the last expression is evaluated ROUNDS times
+ * with lambda bodies compiled, and again with `compiling` turned off.
+ */
+
+#define ROUNDS 200
+
+static const char* const programs[][2] = {
+    { "reverse",
+      "(set (quote r) (lambda (x y) (cond ((atom x) y) (t (r (cdr x) (cons (car x) y))))))"
+      "(r xs ())" },
+    { "map",
+      "(set (quote map) (lambda (f xs) (cond ((atom xs) xs) (t (cons (f (car xs)) (map f (cdr xs)))))))"
+      "(map (lambda (x) (cons x x)) xs)" },
+    { "append",
+      "(set (quote app) (lambda (xs ys) (cond ((atom xs) ys) (t (cons (car xs) (app (cdr xs) ys))))))"
+      "(set (quote flat) (lambda (xss) (cond ((atom xss) ()) (t (app (car xss) (flat (cdr xss)))))))"
+      "(flat (cons xs (cons xs (cons xs ()))))" },
+    { "builtin",
+      "(set (quote flat) (lambda (xss) (cond ((atom xss) ()) (t (append (car xss) (flat (cdr xss)))))))"
+      "(reverse (flat (cons xs (cons xs (cons xs ())))))" },
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* evaluate program read from source in env; return the last expression, which is not evaluated. */
+static const struct sexp* load(jmp_buf trap, const char* source, const struct sexp** env) {
+    struct source* in = string_source(source, strlen(source));
+    const struct sexp* exp = read_source(trap, in);
+    while (true) {
+        jmp_buf eof;
+        if (setjmp(eof)) {
+            break;
+        }
+        const struct sexp* next = read_source(eof, in);
+        *env = eval(trap, (struct env_exp){ *env, exp }).env;
+        exp = next;
+    }
+    close_source(in);
+    return exp;
+}
+
+static double measure(jmp_buf trap, const char* source, bool compile) {
+    const struct sexp* env = cons(cons(symbol("t"), symbol("True")), NIL());
+    const struct sexp* xs = NIL();
+    unsigned i;
+    for (i = 0; i < 1000; ++i) {
+        xs = cons(symbol("x"), xs);
+    }
+    env = cons(cons(symbol("xs"), xs), env);
+    compiling = compile;
+    const struct sexp* exp = load(trap, source, &env);
+    const double start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        eval(trap, (struct env_exp){ env, exp });
+    }
+    return now() - start;
+}
+
+int main() {
+    jmp_buf trap;
+    unsigned i;
+
+    if (setjmp(trap)) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(programs) / sizeof(*programs); ++i) {
+        const double vm = measure(trap, programs[i][1], true);
+        const double tree = measure(trap, programs[i][1], false);
+        printf("%-8s vm: %.2f ms, tree walker: %.2f ms (%.2fx)\n", programs[i][0], vm * 1e3 / ROUNDS, tree * 1e3 / ROUNDS, tree / vm);
+    }
+    return 0;
+}
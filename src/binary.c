@@ -0,0 +1,463 @@
+#include "ulisp.h"
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern const char* name_of(const struct sexp* exp);
+extern FILE* error_stream();
+extern void gc_pause(bool pause);
+
+/*
+ * Binary form of expressions, exchanged between processes instead of text.
+ *
+ * A stream starts with BINARY_MAGIC, followed by records. Each record is the byte length of an expression,
+ * then the expression written in preorder: a tag byte, then operands in unsigned LEB128 (`varint`).
+ *
+ *   TAG_NIL
+ *   TAG_FIXNUM value          value zigzag encoded, so that small negative numbers are short.
+ *   TAG_NEW_SYMBOL length name  symbol numbered next in the stream, from 0.
+ *   TAG_SYMBOL number         symbol written before in the stream.
+ *   TAG_LIST n                n (> 0) elements follow, then the tail, which is nil for proper list.
+ *
+ * Names of symbols are written only once per stream, so both ends keep table of them.
+ * Atoms other than symbol and number are written as symbols of their names, as `write` does.
+ */
+#define BINARY_MAGIC "ulispbin"
+
+enum binary_tag {
+    TAG_NIL,
+    TAG_FIXNUM,
+    TAG_NEW_SYMBOL,
+    TAG_SYMBOL,
+    TAG_LIST,
+};
+
+/* names of symbols written, numbered in order, and open addressing table of them by name. */
+struct binary_output {
+    FILE* fp;
+    bool started;
+    char** names;
+    size_t count;
+    size_t capacity;
+    size_t* slots;      /* number + 1 of symbol, or 0. */
+    size_t num_slots;
+    unsigned char* buffer; /* record built, then written at once. */
+    size_t length;
+    size_t buffer_capacity;
+    const struct sexp** stack; /* rest of lists being written. */
+    size_t stack_capacity;
+};
+
+/*
+ * Names of symbols read, numbered in order, and symbols interned by them.
+ * Symbols may be collected after the record is read, so they are interned again after collection.
+ */
+struct binary_input {
+    FILE* fp;
+    bool started;
+    char** names;
+    const struct sexp** symbols;
+    size_t count;
+    size_t capacity;
+    size_t collections; /* collections when `symbols` were interned. */
+    unsigned char* buffer;
+    size_t buffer_capacity;
+    const struct sexp** values;    /* elements of lists being read. */
+    size_t values_capacity;
+    struct pending_list {
+        size_t n;       /* elements, then the tail is read. */
+        size_t base;    /* index of the first element in `values`. */
+    } * lists;
+    size_t lists_capacity;
+};
+
+/* streams of `(write-binary x)` and `(read-binary)`, reopened when stdout or stdin is replaced. */
+static _Thread_local struct {
+    FILE* out_fp;
+    struct binary_output* out;
+    FILE* in_fp;
+    struct binary_input* in;
+} standard;
+
+static size_t name_hash(const char* name) {
+    size_t hash = 2166136261u; /* FNV-1a */
+    while (*name) {
+        hash = (hash ^ (unsigned char) *name++) * 16777619u;
+    }
+    return hash;
+}
+
+struct binary_output* open_binary_output(FILE* fp) {
+    struct binary_output* out = calloc(1, sizeof(struct binary_output));
+    out->fp = fp;
+    out->num_slots = 256;
+    out->slots = calloc(out->num_slots, sizeof(*out->slots));
+    return out;
+}
+
+void close_binary_output(struct binary_output* out) {
+    size_t i;
+    for (i = 0; i < out->count; ++i) {
+        free(out->names[i]);
+    }
+    free(out->names);
+    free(out->slots);
+    free(out->buffer);
+    free(out->stack);
+    free(out);
+}
+
+static void put_bytes(struct binary_output* out, const void* p, size_t n) {
+    if (out->length + n > out->buffer_capacity) {
+        while (out->length + n > out->buffer_capacity) {
+            out->buffer_capacity = out->buffer_capacity ? out->buffer_capacity * 2 : 256;
+        }
+        out->buffer = realloc(out->buffer, out->buffer_capacity);
+    }
+    memcpy(out->buffer + out->length, p, n);
+    out->length += n;
+}
+
+/* encode n into bytes, and return how many. */
+static size_t varint(unsigned char bytes[10], uint64_t n) {
+    size_t length = 0;
+    while (n >= 0x80) {
+        bytes[length++] = (unsigned char) (n | 0x80);
+        n >>= 7;
+    }
+    bytes[length++] = (unsigned char) n;
+    return length;
+}
+
+static void put_varint(struct binary_output* out, enum binary_tag tag, uint64_t n) {
+    unsigned char bytes[11] = { tag };
+    put_bytes(out, bytes, 1 + varint(bytes + 1, n));
+}
+
+static size_t* name_slot(size_t* slots, size_t num_slots, char* const* names, const char* name) {
+    size_t i = name_hash(name) & (num_slots - 1);
+    while (slots[i] && strcmp(names[slots[i] - 1], name)) {
+        i = (i + 1) & (num_slots - 1);
+    }
+    return slots + i;
+}
+
+static void put_symbol(struct binary_output* out, const char* name) {
+    size_t* slot = name_slot(out->slots, out->num_slots, out->names, name);
+    if (*slot) {
+        put_varint(out, TAG_SYMBOL, *slot - 1);
+        return;
+    }
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 64;
+        out->names = realloc(out->names, sizeof(*out->names) * out->capacity);
+    }
+    out->names[out->count++] = strdup(name);
+    *slot = out->count;
+    if (2 * out->count > out->num_slots) {
+        size_t* slots = calloc(out->num_slots * 2, sizeof(*slots));
+        size_t i;
+        for (i = 0; i < out->count; ++i) {
+            *name_slot(slots, out->num_slots * 2, out->names, out->names[i]) = i + 1;
+        }
+        free(out->slots);
+        out->slots = slots;
+        out->num_slots *= 2;
+    }
+    const size_t length = strlen(name);
+    put_varint(out, TAG_NEW_SYMBOL, length);
+    put_bytes(out, name, length);
+}
+
+static void put_atom(struct binary_output* out, const struct sexp* exp) {
+    if (nil(exp)) {
+        const unsigned char tag = TAG_NIL;
+        put_bytes(out, &tag, 1);
+    } else if (is_fixnum(exp)) {
+        const intptr_t n = fixnum_value(exp);
+        put_varint(out, TAG_FIXNUM, ((uint64_t) n << 1) ^ (uint64_t) (n >> 63));
+    } else {
+        put_symbol(out, name_of(exp));
+    }
+}
+
+/* write exp into record in a loop, keeping rest of lists being written in a stack instead of C stack. */
+static void encode(struct binary_output* out, const struct sexp* exp) {
+    size_t depth = 0;
+    while (true) {
+        if (atom(exp)) {
+            put_atom(out, exp);
+        } else {
+            size_t n = 0;
+            const struct sexp* rest;
+            for (rest = exp; !atom(rest); rest = snd(rest)) {
+                n += 1;
+            }
+            put_varint(out, TAG_LIST, n);
+            if (depth == out->stack_capacity) {
+                out->stack_capacity = out->stack_capacity ? out->stack_capacity * 2 : 16;
+                out->stack = realloc(out->stack, sizeof(*out->stack) * out->stack_capacity);
+            }
+            out->stack[depth++] = snd(exp);
+            exp = fst(exp);
+            continue;
+        }
+
+        /* then go on to next element of innermost list, writing tails of lists ended. */
+        while (depth) {
+            const struct sexp** rest = out->stack + depth - 1;
+            if (!atom(*rest)) {
+                exp = fst(*rest);
+                *rest = snd(*rest);
+                break;
+            }
+            put_atom(out, *rest);
+            depth -= 1;
+        }
+        if (!depth) {
+            break;
+        }
+    }
+}
+
+bool write_binary(struct binary_output* out, const struct sexp* exp) {
+    unsigned char length[10];
+    out->length = 0;
+    encode(out, exp);
+    bool ok = out->started || fwrite(BINARY_MAGIC, sizeof(BINARY_MAGIC) - 1, 1, out->fp) == 1;
+    out->started = true;
+    ok = ok && fwrite(length, varint(length, out->length), 1, out->fp) == 1;
+    return ok && fwrite(out->buffer, out->length, 1, out->fp) == 1;
+}
+
+struct binary_input* open_binary_input(FILE* fp) {
+    struct binary_input* in = calloc(1, sizeof(struct binary_input));
+    in->fp = fp;
+    return in;
+}
+
+void close_binary_input(struct binary_input* in) {
+    size_t i;
+    for (i = 0; i < in->count; ++i) {
+        free(in->names[i]);
+    }
+    free(in->names);
+    free(in->symbols);
+    free(in->buffer);
+    free(in->values);
+    free(in->lists);
+    free(in);
+}
+
+/* decoding state of a record in [p, end). */
+struct decoder {
+    const unsigned char* p;
+    const unsigned char* end;
+};
+
+static void malformed(jmp_buf trap, const char* message) {
+    fprintf(error_stream(), "%s", message);
+    fflush(error_stream());
+    longjmp(trap, TRAP_ILLARG);
+}
+
+static bool get_varint(struct decoder* d, uint64_t* n) {
+    unsigned shift;
+    *n = 0;
+    for (shift = 0; d->p < d->end && shift < 64; shift += 7) {
+        const unsigned char byte = *d->p++;
+        *n |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const struct sexp* new_symbol(struct binary_input* in, const char* name, size_t length) {
+    if (in->count == in->capacity) {
+        in->capacity = in->capacity ? in->capacity * 2 : 64;
+        in->names = realloc(in->names, sizeof(*in->names) * in->capacity);
+        in->symbols = realloc(in->symbols, sizeof(*in->symbols) * in->capacity);
+    }
+    char* copy = malloc(length + 1);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    in->names[in->count] = copy;
+    return in->symbols[in->count++] = symbol(copy);
+}
+
+/* number of collections so far, after which interned symbols may be gone. */
+static size_t collections() {
+    return gc_stats().collections;
+}
+
+/* decode an expression, or return false if record is malformed. collection must be paused. */
+static bool decode(struct binary_input* in, struct decoder* d, const struct sexp** result) {
+    size_t depth = 0;
+    size_t count = 0;   /* values in `values`. */
+    while (d->p < d->end) {
+        const struct sexp* value;
+        uint64_t n = 0;
+        const unsigned char tag = *d->p++;
+        if (tag != TAG_NIL && !get_varint(d, &n)) {
+            return false;
+        }
+        switch (tag) {
+        case TAG_NIL:
+            value = NIL();
+            break;
+        case TAG_FIXNUM: {
+            const intptr_t i = (intptr_t) (n >> 1) ^ -(intptr_t) (n & 1);
+            if (fixnum_value(fixnum(i)) != i) {
+                return false;
+            }
+            value = fixnum(i);
+            break;
+        }
+        case TAG_NEW_SYMBOL:
+            if (n > (uint64_t) (d->end - d->p) || memchr(d->p, '\0', n)) {
+                return false;
+            }
+            value = new_symbol(in, (const char*) d->p, n);
+            d->p += n;
+            break;
+        case TAG_SYMBOL:
+            if (n >= in->count) {
+                return false;
+            }
+            if (!in->symbols[n]) {
+                in->symbols[n] = symbol(in->names[n]);
+            }
+            value = in->symbols[n];
+            break;
+        case TAG_LIST:
+            if (n == 0 || n > (uint64_t) (d->end - d->p)) { /* each element takes a byte at least. */
+                return false;
+            }
+            if (depth == in->lists_capacity) {
+                in->lists_capacity = in->lists_capacity ? in->lists_capacity * 2 : 16;
+                in->lists = realloc(in->lists, sizeof(*in->lists) * in->lists_capacity);
+            }
+            in->lists[depth++] = (struct pending_list){ n, count };
+            continue;
+        default:
+            return false;
+        }
+
+        /* value is an element or the tail of innermost list; make lists whose tails are read. */
+        while (depth) {
+            struct pending_list* list = in->lists + depth - 1;
+            if (count == in->values_capacity) {
+                in->values_capacity = in->values_capacity ? in->values_capacity * 2 : 256;
+                in->values = realloc(in->values, sizeof(*in->values) * in->values_capacity);
+            }
+            in->values[count++] = value;
+            if (count - list->base <= list->n) {
+                break;
+            }
+            value = list_from(list->n, in->values + list->base, value);
+            count = list->base;
+            depth -= 1;
+        }
+        if (!depth) {
+            *result = value;
+            return d->p == d->end;
+        }
+    }
+    return false;
+}
+
+const struct sexp* read_binary(jmp_buf trap, struct binary_input* in) {
+    uint64_t length = 0;
+    unsigned shift;
+    int c = EOF;
+    if (!in->started) {
+        char magic[sizeof(BINARY_MAGIC) - 1];
+        const size_t n = fread(magic, 1, sizeof(magic), in->fp);
+        if (n == 0) {
+            longjmp(trap, TRAP_NOINPUT);
+        }
+        if (n != sizeof(magic) || memcmp(magic, BINARY_MAGIC, sizeof(magic))) {
+            malformed(trap, "Not binary data.");
+        }
+        in->started = true;
+    }
+    for (shift = 0; shift < 64 && (c = getc(in->fp)) != EOF; shift += 7) {
+        length |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+    }
+    if (c == EOF) {
+        if (shift == 0) {
+            longjmp(trap, TRAP_NOINPUT);
+        }
+        malformed(trap, "Unexpected end of data.");
+    }
+    if (length > in->buffer_capacity) {
+        free(in->buffer);
+        in->buffer_capacity = length;
+        in->buffer = malloc(length);
+        if (!in->buffer) {
+            in->buffer_capacity = 0;
+            malformed(trap, "Malformed binary data.");
+        }
+    }
+    if (fread(in->buffer, 1, length, in->fp) != length) {
+        malformed(trap, "Unexpected end of data.");
+    }
+
+    if (in->count && in->collections != collections()) {
+        memset(in->symbols, 0, sizeof(*in->symbols) * in->count);
+    }
+    struct decoder d = { in->buffer, in->buffer + length };
+    const struct sexp* exp = NIL();
+    gc_pause(true); // lists are made from values held in malloc'ed stack.
+    const bool ok = decode(in, &d, &exp);
+    gc_pause(false);
+    in->collections = collections();
+    if (!ok) {
+        malformed(trap, "Malformed binary data.");
+    }
+    return exp;
+}
+
+/* stream of `(write-binary x)` on stdout. */
+struct binary_output* binary_stdout() {
+    if (standard.out_fp != stdout) {
+        if (standard.out) {
+            close_binary_output(standard.out);
+        }
+        standard.out = open_binary_output(stdout);
+        standard.out_fp = stdout;
+    }
+    return standard.out;
+}
+
+/* stream of `(read-binary)` on stdin. */
+struct binary_input* binary_stdin() {
+    if (standard.in_fp != stdin) {
+        if (standard.in) {
+            close_binary_input(standard.in);
+        }
+        standard.in = open_binary_input(stdin);
+        standard.in_fp = stdin;
+    }
+    return standard.in;
+}
+
+/* close streams of `(write-binary x)` and `(read-binary)`. */
+void binary_release() {
+    if (standard.out) {
+        close_binary_output(standard.out);
+    }
+    if (standard.in) {
+        close_binary_input(standard.in);
+    }
+    memset(&standard, 0, sizeof(standard));
+}
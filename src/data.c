@@ -1,37 +1,131 @@
 #include "ulisp.h"
 
 #include <memory.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Type of object, which is the type of the page the object is allocated in (see `gc_type`).
+ * Objects carry no type word; pointer to a pair is also tagged, so `atom` needs no memory access.
+ */
 enum tag {
     SYMBOL,
     PAIR,
     APPLICABLE,
+    FRAME,
+    LOCAL,
+    CODE,
+    MEMO,
+    NATIVE,
 };
 
-struct sexp {
-    enum tag tag;
-};
+/*
+ * Low bits of sexp pointer; objects are aligned to 8 bytes.
+ * xx1: fixnum, 010: pair, 000: other object (or nil).
+ */
+#define PAIR_TAG 2
+#define TAG_MASK 7
 
 struct symbol {
-    enum tag tag;
     char p[1];
 };
 
 struct pair {
-    enum tag tag;
     const struct sexp* fst;
     const struct sexp* snd;
 };
 
 struct applicable {
-    enum tag tag;
     const struct sexp* env;
     const struct sexp* params;
     const struct sexp* body;
 };
 
+/*
+ * Bindings of a function call: i-th value is bound to i-th symbol of params.
+ * If params ends with a symbol (dotted), it is bound to the last value.
+ * Links to other environments are held by pointer, so a call allocates only this frame.
+ */
+struct frame {
+    const struct sexp* params;
+    const struct sexp* captured;    /* environment closure captured. */
+    const struct sexp* global;      /* top level environment of the call site. */
+    size_t size;
+    const struct sexp* values[];
+};
+
+/* reference to variable resolved to `slot` of frame which is `depth` frames outer. */
+struct local {
+    unsigned depth;
+    unsigned slot;
+    const struct sexp* symbol;
+};
+
+/*
+ * Compiled lambda body: `length` instructions follow `size` constants they refer to.
+ * `body` is the source, kept for the tree walker (e.g. while tracing).
+ */
+struct code {
+    const struct sexp* body;
+    unsigned size;
+    unsigned length;
+    const struct sexp* consts[];
+};
+
+/*
+ * Results of applicable `func` memoized by argument list, at most `capacity` of them.
+ *
+ * Entries are chained from `buckets` by structural hash of key, and linked in order of use
+ * from `head` (most recent) to `tail`, which is evicted first. Buckets follow entries.
+ */
+#define NO_ENTRY ((unsigned) -1)
+
+struct memo {
+    const struct sexp* func;
+    unsigned capacity;
+    unsigned count;
+    size_t hits;
+    size_t misses;
+    unsigned head;
+    unsigned tail;
+    struct memo_entry {
+        const struct sexp* key;
+        const struct sexp* value;
+        size_t hash;
+        unsigned prev;
+        unsigned next;
+        unsigned chain;
+    } entries[];
+};
+
+/*
+ * Function of host called with list of arguments, which must be `arity` long unless arity is negative.
+ * It is the body of an applicable, as memo is. `f` is NULL once saved into image, where it would be invalid,
+ * and it is taken from the function made by the same name in this process on the first call.
+ */
+struct native {
+    const struct sexp* name;
+    native_function f;
+    void* data;
+    int arity;
+};
+
+extern void* gc_alloc(unsigned type, size_t size);
+extern unsigned gc_type(const struct sexp* exp);
+extern size_t gc_size(const struct sexp* exp);
+extern bool gc_owned(const struct sexp* exp);
+extern void gc_pause(bool pause);
+extern struct image* image_new();
+extern const struct sexp* image_place(struct image* image, const struct sexp* exp, void** copy, unsigned* type);
+extern bool image_write(struct image* image, const char* path, const struct sexp* root);
+extern bool gc_map_image(const char* path, const struct sexp** root, intptr_t* delta, char** start, size_t* bytes);
+extern void gc_image_objects(char* start, size_t bytes, unsigned type, void (*f)(struct sexp* exp, void* arg), void* arg);
+extern size_t gc_bytes_per_object(size_t size);
+extern size_t gc_alloc_run(unsigned type, size_t size, size_t n, void** run);
+
 const struct sexp* NIL() {
     return NULL;
 }
@@ -40,60 +134,278 @@ bool nil(const struct sexp* sexp) {
     return !sexp;
 }
 
+/*
+ * Fixnum is an integer held in the pointer itself, tagged by the lowest bit
+ * which is always 0 for objects on the heap.
+ */
+const struct sexp* fixnum(intptr_t n) {
+    return (const void*) ((uintptr_t) n << 1 | 1);
+}
+
+bool is_fixnum(const struct sexp* sexp) {
+    return (uintptr_t) sexp & 1;
+}
+
+intptr_t fixnum_value(const struct sexp* sexp) {
+    return (intptr_t) sexp >> 1;
+}
+
+/* test whether sexp points to an object other than pair, whose type is that of its page. */
+static bool boxed(const struct sexp* sexp) {
+    return !nil(sexp) && !((uintptr_t) sexp & TAG_MASK);
+}
+
 bool atom(const struct sexp* sexp) {
-    return nil(sexp) || sexp->tag != PAIR;
+    return ((uintptr_t) sexp & TAG_MASK) != PAIR_TAG;
+}
+
+static const struct sexp* tag_pair(const struct pair* pair) {
+    return (const void*) ((const char*) pair + PAIR_TAG);
+}
+
+static const struct pair* pair_of(const struct sexp* sexp) {
+    return (const void*) ((const char*) sexp - PAIR_TAG);
+}
+
+/* open addressing table of interned symbols; capacity is always power of 2. */
+static _Thread_local struct intern_table {
+    struct symbol** slots;
+    size_t capacity;
+    size_t count;
+} symbols;
+
+/* table of another thread looked up first, while running its job (see `borrow_symbols`). */
+static _Thread_local const struct intern_table* borrowed;
+
+static size_t hash_of(const char* name) {
+    size_t hash = 2166136261u; /* FNV-1a */
+    while (*name) {
+        hash = (hash ^ (unsigned char) *name++) * 16777619u;
+    }
+    return hash;
+}
+
+static struct symbol** intern_slot(struct symbol** slots, size_t capacity, const char* name) {
+    size_t i = hash_of(name) & (capacity - 1);
+    while (slots[i] && strcmp(slots[i]->p, name)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return slots + i;
+}
+
+static void intern_grow() {
+    const size_t capacity = symbols.capacity ? symbols.capacity * 2 : 256;
+    struct symbol** slots = calloc(capacity, sizeof(struct symbol*));
+    size_t i;
+    for (i = 0; i < symbols.capacity; ++i) {
+        if (symbols.slots[i]) {
+            *intern_slot(slots, capacity, symbols.slots[i]->p) = symbols.slots[i];
+        }
+    }
+    free(symbols.slots);
+    symbols.slots = slots;
+    symbols.capacity = capacity;
 }
 
 const struct sexp* symbol(const char* name) {
-    struct symbol* exp = malloc(sizeof(struct symbol) + strlen(name));
-    exp->tag = SYMBOL;
-    strcpy(exp->p, name);
-    return (void*) exp;
+    if (borrowed && borrowed->capacity) {
+        struct symbol* const found = *intern_slot(borrowed->slots, borrowed->capacity, name);
+        if (found) {
+            return (void*) found;
+        }
+    }
+    if (2 * (symbols.count + 1) > symbols.capacity) {
+        intern_grow();
+    }
+    struct symbol** slot = intern_slot(symbols.slots, symbols.capacity, name);
+    if (!*slot) {
+        size_t size = 16; /* symbols of similar length share pages. */
+        while (size < sizeof(struct symbol) + strlen(name)) {
+            size *= 2;
+        }
+        struct symbol* exp = gc_alloc(SYMBOL, size);
+        strcpy(exp->p, name);
+        slot = intern_slot(symbols.slots, symbols.capacity, name); /* gc_alloc may rebuild the table. */
+        *slot = exp;
+        symbols.count += 1;
+    }
+    return (void*) *slot;
+}
+
+void intern_sweep(bool (*marked)(const struct sexp*)) {
+    struct symbol** slots = symbols.slots;
+    size_t i;
+    symbols.slots = calloc(symbols.capacity, sizeof(struct symbol*));
+    symbols.count = 0;
+    for (i = 0; i < symbols.capacity; ++i) {
+        if (slots[i] && marked((void*) slots[i])) {
+            *intern_slot(symbols.slots, symbols.capacity, slots[i]->p) = slots[i];
+            symbols.count += 1;
+        }
+    }
+    free(slots);
+}
+
+/* symbol table of this thread, to be borrowed by another. */
+const void* symbol_table() {
+    return &symbols;
+}
+
+/*
+ * Look up symbols in table of another thread before this one's, or stop it if table is NULL.
+ * The other thread must not intern nor collect meanwhile. Names not found there are interned here.
+ */
+void borrow_symbols(const void* table) {
+    borrowed = table;
+}
+
+/* number of pairs allocated ever. */
+static _Thread_local size_t conses;
+
+size_t cons_count() {
+    return conses;
+}
+
+/* forget all symbols, whose heap is released. */
+void intern_release() {
+    free(symbols.slots);
+    memset(&symbols, 0, sizeof(symbols));
+    conses = 0;
 }
 
 const struct sexp* cons(const struct sexp* fst, const struct sexp* snd) {
-    struct pair* exp = malloc(sizeof(struct pair));
-    exp->tag = PAIR;
+    struct pair* exp = gc_alloc(PAIR, sizeof(struct pair));
+    conses += 1;
     exp->fst = fst;
     exp->snd = snd;
-    return (void*) exp;
+    return tag_pair(exp);
+}
+
+const struct sexp* list_from(size_t n, const struct sexp* const* elements, const struct sexp* tail) {
+    const struct sexp* head = tail;
+    const struct sexp** link = &head;
+    while (n) {
+        struct pair* run;
+        size_t k = gc_alloc_run(PAIR, sizeof(struct pair), n, (void**) &run);
+        n -= k;
+        conses += k;
+        for (; k--; ++run) {
+            run->fst = *elements++;
+            run->snd = tail;
+            *link = tag_pair(run);
+            link = &run->snd;
+        }
+    }
+    return head;
 }
 
 const struct sexp* fst(const struct sexp* sexp) {
-    const struct pair* pair = (const void*) sexp;
-    return pair->fst;
+    return pair_of(sexp)->fst;
 }
 
 const struct sexp* snd(const struct sexp* sexp) {
-    const struct pair* pair = (const void*) sexp;
-    return pair->snd;
+    return pair_of(sexp)->snd;
 }
 
 const char* name_of(const struct sexp* exp) {
-    switch (exp->tag) {
+    if (is_fixnum(exp)) {
+        static _Thread_local char digits[24]; /* valid until next call. */
+        snprintf(digits, sizeof(digits), "%jd", (intmax_t) fixnum_value(exp));
+        return digits;
+    }
+    switch (gc_type(exp)) {
     case SYMBOL:
         return ((const struct symbol*)exp)->p;
     case APPLICABLE:
         return "*applicable*";
+    case FRAME:
+        return "*frame*";
+    case LOCAL:
+        return name_of(((const struct local*)exp)->symbol);
+    case CODE:
+        return "*code*";
+    case MEMO:
+        return "*memo*";
+    case NATIVE:
+        return "*native*";
     default:
         return "";
     }
 }
 
 const struct sexp* make_applicable(const struct sexp* env, const struct sexp* params, const struct sexp* body) {
-    struct sexp* applicable = malloc(sizeof(struct applicable));
-    memcpy(applicable, &(struct applicable) { .tag = APPLICABLE, .env = env, .params = params, .body = body, }, sizeof(struct applicable));
+    struct sexp* applicable = gc_alloc(APPLICABLE, sizeof(struct applicable));
+    memcpy(applicable, &(struct applicable) { .env = env, .params = params, .body = body, }, sizeof(struct applicable));
     return applicable;
 }
 
+/* exp may be tagged or not, as it is reached from another object or from the C stack. */
+void trace(const struct sexp* exp, void (*mark)(const struct sexp*)) {
+    const unsigned type = gc_type(exp);
+    exp = (const void*) ((uintptr_t) exp & ~(uintptr_t) TAG_MASK);
+    switch (type) {
+    case PAIR:
+        mark(((const struct pair*) exp)->fst);
+        mark(((const struct pair*) exp)->snd);
+        break;
+    case APPLICABLE:
+        mark(((const struct applicable*) exp)->env);
+        mark(((const struct applicable*) exp)->params);
+        mark(((const struct applicable*) exp)->body);
+        break;
+    case FRAME: {
+        const struct frame* frame = (const void*) exp;
+        size_t i;
+        mark(frame->params);
+        mark(frame->captured);
+        mark(frame->global);
+        for (i = 0; i < frame->size; ++i) {
+            mark(frame->values[i]);
+        }
+        break;
+    }
+    case LOCAL:
+        mark(((const struct local*) exp)->symbol);
+        break;
+    case CODE: {
+        const struct code* code = (const void*) exp;
+        unsigned i;
+        mark(code->body);
+        for (i = 0; i < code->size; ++i) {
+            mark(code->consts[i]);
+        }
+        break;
+    }
+    case MEMO: {
+        const struct memo* memo = (const void*) exp;
+        unsigned i;
+        mark(memo->func);
+        for (i = 0; i < memo->count; ++i) {
+            mark(memo->entries[i].key);
+            mark(memo->entries[i].value);
+        }
+        break;
+    }
+    case NATIVE:
+        mark(((const struct native*) exp)->name);
+        break;
+    default:
+        break;
+    }
+}
+
 static const struct applicable* make_sure_applicable(jmp_buf trap, const struct sexp* exp) {
-    if (exp->tag != APPLICABLE) {
+    if (!boxed(exp) || gc_type(exp) != APPLICABLE) {
         longjmp(trap, TRAP_NOTAPPLICABLE);
     } else {
         return (void*)exp;
     }
 }
 
+bool is_applicable(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == APPLICABLE;
+}
+
 const struct sexp* get_environment(jmp_buf trap, const struct sexp* exp) {
     return make_sure_applicable(trap, exp)->env;
 }
@@ -105,3 +417,557 @@ const struct sexp* get_body(jmp_buf trap, const struct sexp* exp) {
 const struct sexp* get_params(jmp_buf trap, const struct sexp* exp) {
     return make_sure_applicable(trap, exp)->params;
 }
+
+const struct sexp* make_frame(const struct sexp* params, const struct sexp* const* values, size_t size,
+                              const struct sexp* captured, const struct sexp* global) {
+    struct frame* frame = gc_alloc(FRAME, sizeof(struct frame) + sizeof(*values) * size);
+    frame->params = params;
+    frame->captured = captured;
+    frame->global = global;
+    frame->size = size;
+    memcpy(frame->values, values, sizeof(*values) * size);
+    return (void*) frame;
+}
+
+bool is_frame(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == FRAME;
+}
+
+const struct sexp* frame_params(const struct sexp* exp) {
+    return ((const struct frame*) exp)->params;
+}
+
+const struct sexp* frame_captured(const struct sexp* exp) {
+    return ((const struct frame*) exp)->captured;
+}
+
+const struct sexp* frame_global(const struct sexp* exp) {
+    return ((const struct frame*) exp)->global;
+}
+
+const struct sexp* frame_value(const struct sexp* exp, size_t slot) {
+    return ((const struct frame*) exp)->values[slot];
+}
+
+const struct sexp* make_local(const struct sexp* symbol, unsigned depth, unsigned slot) {
+    struct local* local = gc_alloc(LOCAL, sizeof(struct local));
+    memcpy(local, &(struct local) { .depth = depth, .slot = slot, .symbol = symbol, }, sizeof(struct local));
+    return (void*) local;
+}
+
+bool is_local(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == LOCAL;
+}
+
+bool is_symbol(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == SYMBOL;
+}
+
+/* value of local variable exp in environment env, which must be the frame exp was resolved for. */
+const struct sexp* local_value(const struct sexp* env, const struct sexp* exp) {
+    const struct local* local = (const void*) exp;
+    unsigned depth = local->depth;
+    while (depth--) {
+        env = ((const struct frame*) env)->captured;
+    }
+    return ((const struct frame*) env)->values[local->slot];
+}
+
+const struct sexp* make_code(const struct sexp* body, const struct sexp* const* consts, unsigned size,
+                             const unsigned* ops, unsigned length) {
+    struct code* code = gc_alloc(CODE, sizeof(struct code) + sizeof(*consts) * size + sizeof(*ops) * length);
+    code->body = body;
+    code->size = size;
+    code->length = length;
+    memcpy(code->consts, consts, sizeof(*consts) * size);
+    memcpy(code->consts + size, ops, sizeof(*ops) * length);
+    return (void*) code;
+}
+
+bool is_code(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == CODE;
+}
+
+const struct sexp* code_body(const struct sexp* exp) {
+    return ((const struct code*) exp)->body;
+}
+
+const struct sexp* const* code_consts(const struct sexp* exp) {
+    return ((const struct code*) exp)->consts;
+}
+
+const unsigned* code_ops(const struct sexp* exp) {
+    const struct code* code = (const void*) exp;
+    return (const unsigned*) (code->consts + code->size);
+}
+
+const struct sexp* make_memo(const struct sexp* func, unsigned capacity) {
+    const size_t size = sizeof(struct memo) + sizeof(struct memo_entry) * capacity + sizeof(unsigned) * capacity;
+    struct memo* memo = gc_alloc(MEMO, size);
+    memset(memo, 0, sizeof(struct memo));
+    memo->func = func;
+    memo->capacity = capacity;
+    memo->head = memo->tail = NO_ENTRY;
+    memset(memo->entries + capacity, 0xff, sizeof(unsigned) * capacity);
+    return (void*) memo;
+}
+
+/* functions of host made so far by name, shared by threads, to resolve those loaded from image. */
+static struct {
+    pthread_mutex_t lock;
+    struct registered {
+        char* name;
+        native_function f;
+        void* data;
+        int arity;
+    } * entries;
+    size_t count;
+} natives = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+const struct sexp* make_native(const char* name, int arity, native_function f, void* data) {
+    const struct sexp* sym = symbol(name);
+    struct native* native = gc_alloc(NATIVE, sizeof(struct native));
+    *native = (struct native){ .name = sym, .f = f, .data = data, .arity = arity };
+    size_t i;
+    pthread_mutex_lock(&natives.lock);
+    for (i = 0; i < natives.count && strcmp(natives.entries[i].name, name); ++i) {
+    }
+    if (i == natives.count) {
+        natives.entries = realloc(natives.entries, sizeof(*natives.entries) * (natives.count + 1));
+        natives.entries[natives.count++].name = strdup(name);
+    }
+    natives.entries[i].f = f;
+    natives.entries[i].data = data;
+    natives.entries[i].arity = arity;
+    pthread_mutex_unlock(&natives.lock);
+    return (void*) native;
+}
+
+bool is_native(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == NATIVE;
+}
+
+/*
+ * function of native, taken from the one made by its name if it is loaded from image, or NULL if none is made.
+ * store its arity and data of host into *arity and *data.
+ */
+native_function native_of(const struct sexp* exp, int* arity, void** data) {
+    struct native* native = (void*) exp;
+    struct registered found = { .f = native->f, .data = native->data, .arity = native->arity };
+    if (!found.f) {
+        const char* name = name_of(native->name);
+        size_t i;
+        pthread_mutex_lock(&natives.lock);
+        for (i = 0; i < natives.count; ++i) {
+            if (!strcmp(natives.entries[i].name, name)) {
+                found = natives.entries[i];
+            }
+        }
+        pthread_mutex_unlock(&natives.lock);
+        if (found.f && gc_owned(exp)) {
+            native->f = found.f;
+            native->data = found.data;
+            native->arity = found.arity;
+        }
+    }
+    *arity = found.arity;
+    *data = found.data;
+    return found.f;
+}
+
+const struct sexp* native_name(const struct sexp* exp) {
+    return ((const struct native*) exp)->name;
+}
+
+bool is_memo(const struct sexp* exp) {
+    return boxed(exp) && gc_type(exp) == MEMO;
+}
+
+const struct sexp* memo_func(const struct sexp* exp) {
+    return ((const struct memo*) exp)->func;
+}
+
+/* store hits, misses, number of entries and capacity of memo into stats. */
+void memo_stats(const struct sexp* exp, size_t stats[4]) {
+    const struct memo* memo = (const void*) exp;
+    stats[0] = memo->hits;
+    stats[1] = memo->misses;
+    stats[2] = memo->count;
+    stats[3] = memo->capacity;
+}
+
+/* hash of structure; atoms (interned symbols, fixnums, and others by identity) are hashed by pointer. */
+static size_t hash_sexp(const struct sexp* exp) {
+    size_t hash = 2166136261u;
+    while (!atom(exp)) {
+        hash = (hash ^ hash_sexp(fst(exp))) * 16777619u;
+        exp = snd(exp);
+    }
+    return (hash ^ ((uintptr_t) exp >> 1)) * 16777619u;
+}
+
+/* test whether x and y have the same structure, whose atoms are identical. */
+bool equal(const struct sexp* x, const struct sexp* y) {
+    while (!atom(x) && !atom(y)) {
+        if (!equal(fst(x), fst(y))) {
+            return false;
+        }
+        x = snd(x);
+        y = snd(y);
+    }
+    return x == y;
+}
+
+static unsigned* memo_bucket(struct memo* memo, size_t hash) {
+    return (unsigned*) (memo->entries + memo->capacity) + hash % memo->capacity;
+}
+
+static void memo_unlink(struct memo* memo, unsigned i) {
+    struct memo_entry* entry = memo->entries + i;
+    *(entry->prev == NO_ENTRY ? &memo->head : &memo->entries[entry->prev].next) = entry->next;
+    *(entry->next == NO_ENTRY ? &memo->tail : &memo->entries[entry->next].prev) = entry->prev;
+}
+
+static void memo_link(struct memo* memo, unsigned i) {
+    struct memo_entry* entry = memo->entries + i;
+    entry->prev = NO_ENTRY;
+    entry->next = memo->head;
+    *(memo->head == NO_ENTRY ? &memo->tail : &memo->entries[memo->head].prev) = i;
+    memo->head = i;
+}
+
+/* store value memoized for key into *value and return true, or return false if there is not. */
+bool memo_get(const struct sexp* exp, const struct sexp* key, const struct sexp** value) {
+    struct memo* memo = (void*) exp;
+    const size_t hash = hash_sexp(key);
+    unsigned i;
+    for (i = *memo_bucket(memo, hash); i != NO_ENTRY; i = memo->entries[i].chain) {
+        if (memo->entries[i].hash == hash && equal(memo->entries[i].key, key)) {
+            memo_unlink(memo, i);
+            memo_link(memo, i);
+            memo->hits += 1;
+            *value = memo->entries[i].value;
+            return true;
+        }
+    }
+    memo->misses += 1;
+    return false;
+}
+
+/* memoize value for key, replacing the one memoized for equal key; evict least recently used one if full. */
+void memo_put(const struct sexp* exp, const struct sexp* key, const struct sexp* value) {
+    struct memo* memo = (void*) exp;
+    const size_t hash = hash_sexp(key);
+    unsigned i;
+    for (i = *memo_bucket(memo, hash); i != NO_ENTRY; i = memo->entries[i].chain) {
+        if (memo->entries[i].hash == hash && equal(memo->entries[i].key, key)) {
+            memo->entries[i].value = value; // put by recursive call while value was computed.
+            return;
+        }
+    }
+    i = memo->count;
+    if (memo->count == memo->capacity) {
+        i = memo->tail;
+        memo_unlink(memo, i);
+        unsigned* p = memo_bucket(memo, memo->entries[i].hash);
+        while (*p != i) {
+            p = &memo->entries[*p].chain;
+        }
+        *p = memo->entries[i].chain;
+    } else {
+        memo->count += 1;
+    }
+    unsigned* bucket = memo_bucket(memo, hash);
+    memo->entries[i] = (struct memo_entry){ .key = key, .value = value, .hash = hash, .chain = *bucket };
+    *bucket = i;
+    memo_link(memo, i);
+}
+
+/*
+ * Copying object graph of another thread's heap into this one.
+ *
+ * Objects of this thread are shared rather than copied, and symbols are interned by name.
+ * Others are cloned as they are found, and queued in `pending` to have their references
+ * copied in turn, so that sharing and cycles (e.g. through cached globals of code) are kept.
+ * `from` and `to` are an open addressing table of objects cloned and their clones.
+ */
+struct copy {
+    const struct sexp** from;
+    const struct sexp** to;
+    size_t capacity;
+    size_t count;
+    struct sexp** pending;
+    size_t depth;
+    size_t pending_capacity;
+};
+
+static size_t copy_slot(const struct copy* copy, const struct sexp* exp) {
+    size_t i = ((uintptr_t) exp >> 3) * 2654435761u & (copy->capacity - 1);
+    while (copy->from[i] && copy->from[i] != exp) {
+        i = (i + 1) & (copy->capacity - 1);
+    }
+    return i;
+}
+
+static void copy_insert(struct copy* copy, const struct sexp* exp, const struct sexp* clone) {
+    if (2 * (copy->count + 1) > copy->capacity) {
+        const struct copy old = *copy;
+        size_t i;
+        copy->capacity = old.capacity ? old.capacity * 2 : 256;
+        copy->from = calloc(copy->capacity, sizeof(*copy->from));
+        copy->to = calloc(copy->capacity, sizeof(*copy->to));
+        for (i = 0; i < old.capacity; ++i) {
+            if (old.from[i]) {
+                const size_t j = copy_slot(copy, old.from[i]);
+                copy->from[j] = old.from[i];
+                copy->to[j] = old.to[i];
+            }
+        }
+        free(old.from);
+        free(old.to);
+    }
+    const size_t i = copy_slot(copy, exp);
+    copy->from[i] = exp;
+    copy->to[i] = clone;
+    copy->count += 1;
+}
+
+static const struct sexp* copy_object(struct copy* copy, const struct sexp* exp) {
+    if (nil(exp) || is_fixnum(exp) || gc_owned(exp)) {
+        return exp;
+    }
+    const uintptr_t tag = (uintptr_t) exp & TAG_MASK;
+    const struct sexp* object = (const void*) ((uintptr_t) exp - tag);
+    if (copy->capacity) {
+        const size_t i = copy_slot(copy, object);
+        if (copy->from[i]) {
+            return (const void*) ((uintptr_t) copy->to[i] + tag);
+        }
+    }
+    const unsigned type = gc_type(object);
+    struct sexp* clone;
+    if (type == SYMBOL) {
+        clone = (void*) symbol(((const struct symbol*) object)->p);
+    } else {
+        const size_t size = gc_size(object);
+        clone = gc_alloc(type, size);
+        memcpy(clone, object, size);
+        if (copy->depth == copy->pending_capacity) {
+            copy->pending_capacity = copy->pending_capacity ? copy->pending_capacity * 2 : 64;
+            copy->pending = realloc(copy->pending, sizeof(*copy->pending) * copy->pending_capacity);
+        }
+        copy->pending[copy->depth++] = clone;
+    }
+    copy_insert(copy, object, clone);
+    return (const void*) ((uintptr_t) clone + tag);
+}
+
+/* call visit with each slot of object exp of type, which refers a sexp. */
+static void references(struct sexp* exp, unsigned type, void (*visit)(const struct sexp** slot, void* arg), void* arg) {
+    switch (type) {
+    case PAIR: {
+        struct pair* pair = (void*) exp;
+        visit(&pair->fst, arg);
+        visit(&pair->snd, arg);
+        break;
+    }
+    case APPLICABLE: {
+        struct applicable* applicable = (void*) exp;
+        visit(&applicable->env, arg);
+        visit(&applicable->params, arg);
+        visit(&applicable->body, arg);
+        break;
+    }
+    case FRAME: {
+        struct frame* frame = (void*) exp;
+        size_t i;
+        visit(&frame->params, arg);
+        visit(&frame->captured, arg);
+        visit(&frame->global, arg);
+        for (i = 0; i < frame->size; ++i) {
+            visit(&frame->values[i], arg);
+        }
+        break;
+    }
+    case LOCAL:
+        visit(&((struct local*) exp)->symbol, arg);
+        break;
+    case CODE: {
+        struct code* code = (void*) exp;
+        unsigned i;
+        visit(&code->body, arg);
+        for (i = 0; i < code->size; ++i) {
+            visit(&code->consts[i], arg);
+        }
+        break;
+    }
+    case MEMO: {
+        struct memo* memo = (void*) exp;
+        unsigned i;
+        visit(&memo->func, arg);
+        for (i = 0; i < memo->count; ++i) {
+            visit(&memo->entries[i].key, arg);
+            visit(&memo->entries[i].value, arg);
+        }
+        break;
+    }
+    case NATIVE:
+        visit(&((struct native*) exp)->name, arg);
+        break;
+    default:
+        break;
+    }
+}
+
+/* drop results of memo moved to other address, since keys are hashed by address of their atoms. */
+static void forget_memo(struct sexp* exp) {
+    struct memo* memo = (void*) exp;
+    memo->count = 0;
+    memo->head = memo->tail = NO_ENTRY;
+    memset(memo->entries + memo->capacity, 0xff, sizeof(unsigned) * memo->capacity);
+}
+
+static void copy_reference(const struct sexp** slot, void* copy) {
+    *slot = copy_object(copy, *slot);
+}
+
+/*
+ * Copy of exp, which may refer objects of another thread, allocated by this thread.
+ * The other thread must not mutate nor collect its heap meanwhile.
+ */
+const struct sexp* copy_foreign(const struct sexp* exp) {
+    struct copy copy = { 0 };
+    gc_pause(true); // clones are referred only from the table until they are linked.
+    const struct sexp* result = copy_object(&copy, exp);
+    while (copy.depth) {
+        struct sexp* clone = copy.pending[--copy.depth];
+        const unsigned type = gc_type(clone);
+        if (type == MEMO) {
+            forget_memo(clone);
+        }
+        references(clone, type, copy_reference, &copy);
+    }
+    gc_pause(false);
+    free(copy.from);
+    free(copy.to);
+    free(copy.pending);
+    return result;
+}
+
+/* image being written by save_image, and objects written into it whose references are to be replaced. */
+struct save {
+    struct image* image;
+    struct saved {
+        void* copy;
+        unsigned type;
+    } * pending;
+    size_t depth;
+    size_t capacity;
+};
+
+static const struct sexp* save_object(struct save* save, const struct sexp* exp) {
+    struct saved saved;
+    const struct sexp* address = image_place(save->image, exp, &saved.copy, &saved.type);
+    if (saved.copy) {
+        if (saved.type == MEMO) {
+            forget_memo(saved.copy);
+        } else if (saved.type == NATIVE) {
+            ((struct native*) saved.copy)->f = NULL; // functions of host are to be made again after load.
+            ((struct native*) saved.copy)->data = NULL;
+        }
+        if (save->depth == save->capacity) {
+            save->capacity = save->capacity ? save->capacity * 2 : 64;
+            save->pending = realloc(save->pending, sizeof(*save->pending) * save->capacity);
+        }
+        save->pending[save->depth++] = saved;
+    }
+    return address;
+}
+
+static void save_reference(const struct sexp** slot, void* save) {
+    *slot = save_object(save, *slot);
+}
+
+bool save_image(const char* path, const struct sexp* env) {
+    struct save save = { .image = image_new() };
+    const struct sexp* root = save_object(&save, env);
+    while (save.depth) {
+        const struct saved saved = save.pending[--save.depth];
+        references(saved.copy, saved.type, save_reference, &save);
+    }
+    free(save.pending);
+    return image_write(save.image, path, root);
+}
+
+/*
+ * Relocation of image mapped by load_image: references are moved by `delta`,
+ * and symbols of the image whose names were interned already are replaced by those in `symbols`.
+ */
+struct load {
+    intptr_t delta;
+    struct copy symbols;
+};
+
+static void intern_image_symbol(struct sexp* exp, void* arg) {
+    struct load* load = arg;
+    struct symbol* sym = (void*) exp;
+    if (2 * (symbols.count + 1) > symbols.capacity) {
+        intern_grow();
+    }
+    struct symbol** slot = intern_slot(symbols.slots, symbols.capacity, sym->p);
+    if (*slot) {
+        copy_insert(&load->symbols, exp, (void*) *slot);
+    } else {
+        *slot = sym;
+        symbols.count += 1;
+    }
+}
+
+static const struct sexp* relocate(const struct load* load, const struct sexp* exp) {
+    if (nil(exp) || is_fixnum(exp)) {
+        return exp;
+    }
+    exp = (const void*) ((uintptr_t) exp + load->delta);
+    if (load->symbols.count && boxed(exp)) {
+        const size_t i = copy_slot(&load->symbols, exp);
+        if (load->symbols.from[i]) {
+            return load->symbols.to[i];
+        }
+    }
+    return exp;
+}
+
+static void relocate_reference(const struct sexp** slot, void* load) {
+    *slot = relocate(load, *slot);
+}
+
+static void relocate_object(struct sexp* exp, void* load) {
+    references(exp, gc_type(exp), relocate_reference, load);
+}
+
+bool load_image(const char* path, const struct sexp** env) {
+    struct load load = { 0 };
+    const struct sexp* root;
+    char* start;
+    size_t bytes;
+    if (!gc_map_image(path, &root, &load.delta, &start, &bytes)) {
+        return false;
+    }
+    gc_image_objects(start, bytes, SYMBOL, intern_image_symbol, &load);
+    if (load.delta || load.symbols.count) {
+        gc_image_objects(start, bytes, -1, relocate_object, &load);
+    }
+    *env = relocate(&load, root);
+    free(load.symbols.from);
+    free(load.symbols.to);
+    return true;
+}
+
+void heap_report(FILE* fp) {
+    const struct gc_stats stats = gc_stats();
+    fprintf(fp, "%zu objects, %zu bytes, %zu collections\n", stats.objects, stats.bytes, stats.collections);
+    fprintf(fp, "pair: %zu bytes/object\n", gc_bytes_per_object(sizeof(struct pair)));
+    fprintf(fp, "symbol: %zu bytes/object and up, by name length\n", gc_bytes_per_object(16));
+    fprintf(fp, "applicable: %zu bytes/object\n", gc_bytes_per_object(sizeof(struct applicable)));
+    fprintf(fp, "frame: %zu bytes/object and up, by number of parameters\n", gc_bytes_per_object(sizeof(struct frame)));
+}
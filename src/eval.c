@@ -1,28 +1,92 @@
 #include "ulisp.h"
 
+#include <limits.h>
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define STR_EQ(a, b) (strcmp(a, b) == 0)
+#include <time.h>
 
 extern const char* name_of(const struct sexp* exp);
+extern size_t cons_count();
+extern FILE* error_stream();
+extern char* text_limited(const struct sexp* exp, size_t length, size_t level);
+extern void intern_release();
+extern void gc_release();
+extern void read_release();
+extern void binary_release();
+extern struct binary_output* binary_stdout();
+extern struct binary_input* binary_stdin();
+extern const void* symbol_table();
+extern void borrow_symbols(const void* table);
+extern const struct sexp* copy_foreign(const struct sexp* exp);
+
+extern void gc_root(const struct sexp** slot);
+extern bool gc_owned(const struct sexp* exp);
+extern void gc_pause(bool pause);
 
-extern FILE* fdup(FILE* stream, const char* mode);
+extern unsigned pool_size();
+extern bool pool_worker();
+extern size_t pool_run(size_t chunks, void* arg, void (*enter)(void* arg), bool (*run)(void* arg, size_t chunk),
+                       void (*collect)(void* arg), void (*leave)(void* arg));
 
 extern const struct sexp* make_applicable(const struct sexp* env, const struct sexp* params, const struct sexp* body);
 extern const struct sexp* get_environment(jmp_buf trap, const struct sexp* exp);
 extern const struct sexp* get_body(jmp_buf trap, const struct sexp* exp);
 extern const struct sexp* get_params(jmp_buf trap, const struct sexp* exp);
+extern bool is_applicable(const struct sexp* exp);
+extern const struct sexp* make_frame(const struct sexp* params, const struct sexp* const* values, size_t size,
+                                     const struct sexp* captured, const struct sexp* global);
+extern bool is_frame(const struct sexp* exp);
+extern const struct sexp* frame_params(const struct sexp* exp);
+extern const struct sexp* frame_captured(const struct sexp* exp);
+extern const struct sexp* frame_global(const struct sexp* exp);
+extern const struct sexp* frame_value(const struct sexp* exp, size_t slot);
+extern const struct sexp* make_local(const struct sexp* symbol, unsigned depth, unsigned slot);
+extern bool is_local(const struct sexp* exp);
+extern bool is_symbol(const struct sexp* exp);
+extern const struct sexp* local_value(const struct sexp* env, const struct sexp* exp);
+extern const struct sexp* make_code(const struct sexp* body, const struct sexp* const* consts, unsigned size,
+                                    const unsigned* ops, unsigned length);
+extern bool is_code(const struct sexp* exp);
+extern const struct sexp* code_body(const struct sexp* exp);
+extern const struct sexp* const* code_consts(const struct sexp* exp);
+extern const unsigned* code_ops(const struct sexp* exp);
+extern const struct sexp* make_memo(const struct sexp* func, unsigned capacity);
+extern bool is_memo(const struct sexp* exp);
+extern const struct sexp* memo_func(const struct sexp* exp);
+extern bool equal(const struct sexp* x, const struct sexp* y);
+extern const struct sexp* make_native(const char* name, int arity, native_function f, void* data);
+extern bool is_native(const struct sexp* exp);
+extern native_function native_of(const struct sexp* exp, int* arity, void** data);
+extern const struct sexp* native_name(const struct sexp* exp);
+extern void memo_stats(const struct sexp* exp, size_t stats[4]);
+extern bool memo_get(const struct sexp* exp, const struct sexp* key, const struct sexp** value);
+extern void memo_put(const struct sexp* exp, const struct sexp* key, const struct sexp* value);
 
 struct print_context;
 
+/*
+ * Special form evaluates whole form `env_exp.exp` (i.e. `(name args...)`) by itself.
+ */
+typedef const struct env_exp (*special_form)(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+
+/* make symbol `name` evaluated by `form` when it appears at head of list. re-registration replaces. */
+void register_form(const char* name, special_form form);
+/* same as register_form, for a form which may return extended environment (e.g. `set`). */
+void register_binding_form(const char* name, special_form form);
+
 static const char* Err_value_not_found = "Value for symbol `%s` not found.";
 static const char* Err_illegal_argument = "Illegal argument: %s";
 static const char* Err_value_not_pair = "`%s` is not pair.";
+static const char* Err_value_not_number = "`%s` is not number.";
+static const char* Err_value_not_list = "`%s` is not list.";
 
-static const struct sexp* find(jmp_buf trap, const char* name, const struct sexp* env);
+static const struct sexp* find(jmp_buf trap, const struct sexp* sym, const struct sexp* env);
+/* store value of sym into *value and return true, or return false if sym is not defined in env. */
+static bool lookup(const struct sexp* sym, const struct sexp* env, const struct sexp** value);
+/* lookup for env of definition list, memoized in `cache`. */
+static bool lookup_defs(const struct sexp* sym, const struct sexp* defs, const struct sexp** value);
 /* return car(cdr(exp)); throw TRAP_ILLARG if cdr(exp) is not pair. exp should be pair. */
 static const struct sexp* cadr(jmp_buf trap, const struct sexp* exp);
 /* return car(cdr(cdr(exp))); throw TRAP_ILLARG if cdr(exp) or cdr(cdr(exp)) is not pair. exp should be pair. */
@@ -32,20 +96,305 @@ typedef const struct sexp* (*leaf_iterator)(const struct sexp*);
 static const struct sexp* leaf(jmp_buf trap, const struct sexp* exp, leaf_iterator* fst_or_snd);
 static const struct sexp* ensure_pair(jmp_buf trap, const struct sexp* exp);
 static const struct env_exp cond(jmp_buf trap, const struct sexp* env, const struct sexp* cond_cdr, struct print_context* print_context);
+/* store branch expression taken by cond into *taken and return true, or store (env: nil) and return false if no branch taken. */
+static bool branch(jmp_buf trap, const struct sexp* env, const struct sexp* cond_cdr, struct print_context* print_context,
+                   struct env_exp* taken);
 static const struct env_exp closure(jmp_buf trap, const struct sexp* env, const struct sexp* exp);
 static const struct env_exp apply(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+/* evaluate application env_exp and bind its arguments; return (frame: body) of callee and store environment after arguments into *env. */
+static const struct env_exp enter(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context,
+                                  const struct sexp** env);
+/* value of applicable func applied to evaluated args, called from an expression in environment of global. */
+static const struct sexp* call(jmp_buf trap, const struct sexp* func, const struct sexp* args, const struct sexp* global,
+                               struct print_context* print_context);
+/* evaluate body of applicable in frame: code object, memo, or list of expressions. */
+static const struct sexp* call_body(jmp_buf trap, const struct sexp* frame, const struct sexp* body, struct print_context* print_context);
 static const struct env_exp map_eval(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
 static const struct sexp* fold_eval(jmp_buf trap, const struct env_exp env_xs, const struct sexp* def_value, struct print_context* print_context);
-static const struct sexp* zip(jmp_buf trap, const struct sexp* xs, const struct sexp* ys);
-static const struct sexp* append_defs(const struct sexp* env, const struct sexp* def);
+/* top level environment seen by callees of an expression in env, which has neither locals nor definitions made by its frame. */
+static const struct sexp* call_site_global(const struct sexp* env);
+/* make frame binding pars to args; throw TRAP_ILLARG with both of them if their lengths mismatch. */
+static const struct sexp* bind(jmp_buf trap, const struct sexp* pars, const struct sexp* args, const struct sexp* captured,
+                               const struct sexp* global);
+/* parameters of lambdas enclosing an expression, innermost first. */
+struct scope {
+    const struct sexp* params;
+    const struct scope* outer;
+};
+static const struct sexp* resolve(const struct sexp* exp, const struct scope* scope);
+static bool binds(const struct sexp* exp);
+/* compile resolved lambda body into code object, or return NULL if it can not be compiled. */
+static const struct sexp* compile(const struct sexp* body);
+/* evaluate code object in frame env, and return value of the last form of the body. */
+static const struct sexp* run(jmp_buf trap, const struct sexp* env, const struct sexp* code, struct print_context* print_context);
+/* record a call of applicable func into profile. */
+static void profile_enter(const struct sexp* func);
+/* finish the innermost call recorded. */
+static void profile_leave();
+/* finish the call under the innermost one, which is its tail call. */
+static void profile_replace();
+/* name applicable value by sym in profile report. */
+static void profile_name(const struct sexp* sym, const struct sexp* value);
+/* lambda bodies are compiled unless this is false, e.g. to compare with the tree walker. shared by all threads. */
+static bool compiling = true;
 static const struct env_exp eval_impl(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
-static const struct env_exp eval_core(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp eval_core(jmp_buf trap, struct env_exp env_exp, struct print_context* print_context);
+
+/*
+ * State below is of the interpreter of each thread.
+ */
+
+#define NUM_PRIMITIVES 8
+
+/* interned symbols eval recognizes by identity. */
+static _Thread_local struct {
+    const struct sexp* t;
+    const struct sexp* verbose_eval;
+    const struct sexp* print_length;
+    const struct sexp* print_level;
+    const struct sexp* profile;
+    const struct sexp* arguments;
+    const struct sexp* primitives[NUM_PRIMITIVES];  /* names of `primitives`, in order. */
+    const struct sexp* builtins[NUM_PRIMITIVES];    /* applicables of `primitives`, which names are bound to unless defined. */
+} S;
+
+/*
+ * Special forms, an open addressing table keyed on symbol object.
+ *
+ * `forms.symbols` holds registered symbols in a list to keep them alive.
+ */
+static _Thread_local struct {
+    struct form_entry {
+        const struct sexp* symbol;
+        special_form form;
+        bool binding;
+    } * entries;
+    size_t capacity;
+    size_t count;
+    const struct sexp* symbols;
+} forms;
+
+/* counters of eval_stats, except conses counted by `cons`; cheap enough to be always on. */
+static _Thread_local struct {
+    size_t evals;
+    size_t calls;
+    size_t links;
+} counters;
+
+/*
+ * Profile of calls, taken while `on`: call count, inclusive and exclusive time per body of applicable.
+ *
+ * Entries are appended to `entries` and found by `index`, an open addressing table of entry numbers
+ * keyed on body. `keep` holds bodies, parameters and names of entries to keep them alive.
+ * `stack` has calls being run; a tail call finishes the caller before the callee is entered.
+ */
+static _Thread_local struct {
+    bool on;
+    bool forced;    /* set by set_profiling regardless of `*profile*`. */
+    struct profile_entry {
+        const struct sexp* body;
+        const struct sexp* params;
+        const struct sexp* name;
+        size_t calls;
+        double total;
+        double self;
+        unsigned active;    /* calls being run. */
+    } * entries;
+    size_t count;
+    size_t capacity;
+    size_t* index;  /* entry number + 1, or 0 if empty; twice as large as capacity. */
+    const struct sexp* keep;
+    struct profile_call {
+        size_t entry;
+        double start;
+        double children;
+    } * stack;
+    size_t depth;
+    size_t stack_capacity;
+} profile;
+
+/*
+ * Memo of lookup in definition lists, direct mapped by (symbol, list).
+ *
+ * Environments are never mutated (`set` conses a new one), so a hit stays valid
+ * as long as the list is alive; entries are GC roots to keep it so.
+ * Top level definitions are looked up here in constant time however many there are.
+ */
+#define CACHE_SIZE 256
+static _Thread_local struct cache_entry {
+    const struct sexp* symbol;
+    const struct sexp* defs;
+    const struct sexp* value;
+    bool found;
+} cache[CACHE_SIZE];
+
+static const struct env_exp form_quote(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_cons(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_atom(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_car(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_cdr(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_set(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_cond(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_lambda(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_gc(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_load(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_save_image(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_write_binary(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_read_binary(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_time(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_profile(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_memo(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_memo_stats(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_pmap(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_add(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_subtract(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_multiply(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_less(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+static const struct env_exp form_equal(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context);
+
+/* function of evaluated arguments; values of `t` are found in env. */
+typedef const struct sexp* (*primitive)(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env);
+
+/* built-in functions, which take from `min` to `max` arguments. */
+static const struct primitive_entry {
+    const char* name;
+    primitive f;
+    unsigned min;
+    unsigned max;
+} primitives[NUM_PRIMITIVES];
+/* native function of applicables in `S.builtins`; data is their entry of `primitives`. */
+static const struct sexp* primitive_native(jmp_buf trap, const struct sexp* args, void* data);
+
+static void init() {
+    if (!S.t) {
+        /* roots first, as interning below may collect symbols made before. */
+        const struct sexp** p = (const struct sexp**) &S;
+        const struct sexp** const end = p + sizeof(S) / sizeof(*p);
+        for (; p < end; ++p) {
+            gc_root(p);
+        }
+        gc_root(&forms.symbols);
+        gc_root(&profile.keep);
+        size_t i;
+        for (i = 0; i < CACHE_SIZE; ++i) {
+            gc_root(&cache[i].symbol);
+            gc_root(&cache[i].defs);
+            gc_root(&cache[i].value);
+        }
+
+        S.t = symbol("t");
+        S.verbose_eval = symbol("*verbose-eval*");
+        S.print_length = symbol("*print-length*");
+        S.print_level = symbol("*print-level*");
+        S.profile = symbol("*profile*");
+        S.arguments = symbol("arguments");
+
+        register_form("quote", form_quote);
+        register_form("cons", form_cons);
+        register_form("atom", form_atom);
+        register_form("car", form_car);
+        register_form("cdr", form_cdr);
+        register_binding_form("set", form_set);
+        register_form("cond", form_cond);
+        register_form("lambda", form_lambda);
+        register_form("gc", form_gc);
+        register_binding_form("load", form_load);
+        register_form("save-image", form_save_image);
+        register_form("write-binary", form_write_binary);
+        register_form("read-binary", form_read_binary);
+        register_form("time", form_time);
+        register_form("profile", form_profile);
+        register_form("memo", form_memo);
+        register_form("memo-stats", form_memo_stats);
+        register_form("pmap", form_pmap);
+        register_form("+", form_add);
+        register_form("-", form_subtract);
+        register_form("*", form_multiply);
+        register_form("<", form_less);
+        register_form("=", form_equal);
+        for (i = 0; i < NUM_PRIMITIVES; ++i) {
+            S.primitives[i] = symbol(primitives[i].name);
+            S.builtins[i] = make_applicable(NIL(), S.arguments, make_native(primitives[i].name, -1, primitive_native, (void*) (primitives + i)));
+        }
+    }
+}
+
+static struct form_entry* form_slot(struct form_entry* entries, size_t capacity, const struct sexp* sym) {
+    size_t i = ((size_t) sym >> 3) * 2654435761u & (capacity - 1);
+    while (entries[i].symbol && entries[i].symbol != sym) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return entries + i;
+}
+
+static void register_form_entry(const char* name, special_form form, bool binding) {
+    init();
+    const struct sexp* sym = symbol(name);
+    if (4 * (forms.count + 1) > forms.capacity) {
+        const size_t capacity = forms.capacity ? forms.capacity * 2 : 64;
+        struct form_entry* entries = calloc(capacity, sizeof(struct form_entry));
+        size_t i;
+        for (i = 0; i < forms.capacity; ++i) {
+            if (forms.entries[i].symbol) {
+                *form_slot(entries, capacity, forms.entries[i].symbol) = forms.entries[i];
+            }
+        }
+        free(forms.entries);
+        forms.entries = entries;
+        forms.capacity = capacity;
+    }
+    struct form_entry* entry = form_slot(forms.entries, forms.capacity, sym);
+    if (!entry->symbol) {
+        forms.count += 1;
+        forms.symbols = cons(sym, forms.symbols);
+    }
+    *entry = (struct form_entry){ sym, form, binding };
+}
 
+void register_form(const char* name, special_form form) {
+    register_form_entry(name, form, false);
+}
+
+void register_binding_form(const char* name, special_form form) {
+    register_form_entry(name, form, true);
+}
+
+/* return special form named by sym, or NULL if sym is not a special form. */
+static special_form form_of(const struct sexp* sym) {
+    return form_slot(forms.entries, forms.capacity, sym)->form;
+}
+
+static bool binding_form(const struct sexp* sym) {
+    return form_slot(forms.entries, forms.capacity, sym)->binding;
+}
+
+/* print error message formatted with text of exp into error stream. */
+static void report(const char* format, const struct sexp* exp) {
+    char* p = text(exp);
+    fprintf(error_stream(), format, p);
+    fflush(error_stream());
+    free(p);
+}
+
+/* trace sink set by set_trace_stream, or NULL for stdout. */
+static _Thread_local FILE* trace_sink;
+
+/* verbose_eval is the trace sink, NULL unless `*verbose-eval*` is non-nil. */
 struct print_context {
     unsigned call_depth;
     FILE* verbose_eval;
+    size_t print_length;    /* definitions printed for each evaluation, and elements of each list written, at most, or 0. */
+    size_t print_level;     /* lists nested written at most, or 0. */
+    size_t defs;            /* definitions printed for current evaluation. */
 };
 
+/* write exp into trace sink, limited by `*print-length*` and `*print-level*` of evaluation. */
+static void print_exp(const struct sexp* exp, struct print_context* print_context) {
+    char* p = text_limited(exp, print_context->print_length, print_context->print_level);
+    fputs(p, print_context->verbose_eval);
+    free(p);
+}
+
 static void print_nest(struct print_context* print_context) {
     unsigned depth = print_context->call_depth;
     while (depth--) {
@@ -61,133 +410,712 @@ static void unnest(struct print_context* print_context) {
     print_context->call_depth -= 1;
 }
 
+static void print_def(const struct sexp* name, const struct sexp* value, struct print_context* print_context) {
+    if (print_context->print_length && print_context->defs++ >= print_context->print_length) {
+        if (print_context->defs == print_context->print_length + 1) {
+            print_nest(print_context);
+            fprintf(print_context->verbose_eval, " env...\n");
+        }
+        return;
+    }
+    print_nest(print_context);
+    fprintf(print_context->verbose_eval, " env.%s=", name_of(name));
+    print_exp(value, print_context);
+    fprintf(print_context->verbose_eval, "\n");
+}
+
 static void print_env(const struct sexp* env, struct print_context* print_context) {
     while (!atom(env)) {
         const struct sexp* def = fst(env);
-        print_nest(print_context);
-        fprintf(print_context->verbose_eval, " env.%s=%s\n", name_of(fst(def)), text(snd(def)));
+        print_def(fst(def), snd(def), print_context);
         env = snd(env);
     }
+    if (is_frame(env)) {
+        const struct sexp* params = frame_params(env);
+        size_t slot = 0;
+        for (; !atom(params); params = snd(params)) {
+            print_def(fst(params), frame_value(env, slot++), print_context);
+        }
+        if (!nil(params)) {
+            print_def(params, frame_value(env, slot), print_context);
+        }
+        print_env(frame_captured(env), print_context);
+        print_env(frame_global(env), print_context);
+    }
 }
 
-static FILE* file_of_verbose_eval(const struct sexp* env) {
-    bool verbose;
+/* value of sym in env as a count, or 0 if it is not bound to a positive number. */
+static size_t count_of(const struct sexp* sym, const struct sexp* env) {
+    const struct sexp* value;
+    if (lookup(sym, env, &value) && is_fixnum(value) && fixnum_value(value) > 0) {
+        return fixnum_value(value);
+    }
+    return 0;
+}
 
-    jmp_buf trap;
-    FILE* const tmp = stderr;
-    char *p;
-    size_t n;
-    stderr = open_memstream(&p, &n);
+const struct env_exp eval(jmp_buf trap, const struct env_exp env_exp) {
+    init();
+    struct print_context print_context = {
+        .call_depth = 0,
+        .verbose_eval = NULL,
+        .print_length = count_of(S.print_length, env_exp.env),
+        .print_level = count_of(S.print_level, env_exp.env),
+    };
+    const struct sexp* verbose;
+    if (lookup(S.verbose_eval, env_exp.env, &verbose) && !nil(verbose)) {
+        print_context.verbose_eval = trace_sink ? trace_sink : stdout;
+    }
+    const struct sexp* profiling;
+    profile.on = profile.forced || (lookup(S.profile, env_exp.env, &profiling) && !nil(profiling));
+    if (!profile.on) {
+        return eval_impl(trap, env_exp, &print_context);
+    }
 
-    if (setjmp(trap)) {
-        verbose = false;
-    } else {
-        verbose = find(trap, "*verbose-eval*", env) != NIL();
+    /* calls left by error are finished at the error. */
+    const size_t depth = profile.depth;
+    jmp_buf trap2;
+    const int code = setjmp(trap2);
+    if (code) {
+        while (profile.depth > depth) {
+            profile_leave();
+        }
+        longjmp(trap, code);
     }
+    return eval_impl(trap2, env_exp, &print_context);
+}
 
-    fclose(stderr);
+void write_value(FILE* fp, const struct sexp* env, const struct sexp* exp) {
+    init();
+    char* p = text_limited(exp, count_of(S.print_length, env), count_of(S.print_level, env));
+    fputs(p, fp);
     free(p);
-    stderr = tmp;
+}
 
-    if (verbose) {
-        return fdup(stdout, "w");
-    } else {
-        return fopen("/dev/null", "w");
+const struct env_exp eval_string(jmp_buf trap, const struct sexp* env, const char* p, size_t n) {
+    struct source* const source = string_source(p, n);
+    const struct sexp* volatile last = env;
+    const struct sexp* volatile value = NIL();
+    jmp_buf trap2;
+    const int code = setjmp(trap2);
+    if (code == TRAP_NONE) {
+        while (true) {
+            const struct env_exp r = eval(trap2, (struct env_exp){ last, read_source(trap2, source) });
+            last = r.env;
+            value = r.exp;
+        }
     }
+    close_source(source);
+    if (code != TRAP_NOINPUT) {
+        longjmp(trap, code);
+    }
+    return (struct env_exp){ last, value };
 }
 
-const struct env_exp eval(jmp_buf trap, const struct env_exp env_exp) {
-    struct print_context print_context = {
-        .call_depth = 0,
-        .verbose_eval = file_of_verbose_eval(env_exp.env),
-    };
-    struct env_exp result = eval_impl(trap, env_exp, &print_context);
-    fclose(print_context.verbose_eval);
-    return result;
+const struct sexp* native(const char* name, int arity, native_function f, void* data) {
+    init();
+    return make_applicable(NIL(), S.arguments, make_native(name, arity, f, data));
+}
+
+const struct sexp* define(const struct sexp* env, const char* name, const struct sexp* value) {
+    const struct sexp* sym = symbol(name);
+    if (profile.on) {
+        profile_name(sym, value);
+    }
+    return cons(cons(sym, value), env);
+}
+
+void set_trace_stream(FILE* fp) {
+    trace_sink = fp;
+}
+
+void release_interpreter() {
+    gc_release();
+    intern_release();
+    read_release();
+    binary_release();
+    free(forms.entries);
+    free(profile.entries);
+    free(profile.index);
+    free(profile.stack);
+    memset(&S, 0, sizeof(S));
+    memset(&forms, 0, sizeof(forms));
+    memset(&counters, 0, sizeof(counters));
+    memset(&profile, 0, sizeof(profile));
+    memset(cache, 0, sizeof(cache));
+    set_print_limits(0, 0);
+}
+
+struct eval_stats eval_stats() {
+    return (struct eval_stats){ .evals = counters.evals, .calls = counters.calls, .conses = cons_count(), .links = counters.links };
 }
 
 const struct env_exp eval_impl(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    counters.evals += 1;
+    if (!print_context->verbose_eval) {
+        return eval_core(trap, env_exp, print_context);
+    }
+
     print_nest(print_context);
-    fprintf(print_context->verbose_eval, "EVALUATE: %s\n", text(env_exp.exp));
+    fprintf(print_context->verbose_eval, "EVALUATE: ");
+    print_exp(env_exp.exp, print_context);
+    fprintf(print_context->verbose_eval, "\n");
     ennest(print_context);
+    print_context->defs = 0;
     print_env(env_exp.env, print_context);
 
     struct env_exp result = eval_core(trap, env_exp, print_context);
 
     unnest(print_context);
     print_nest(print_context);
-    fprintf(print_context->verbose_eval, "\\___ %s\n", text(result.exp));
+    fprintf(print_context->verbose_eval, "\\___ ");
+    print_exp(result.exp, print_context);
+    fprintf(print_context->verbose_eval, "\n");
     return result;
 }
 
 
-static const struct env_exp eval_core(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
-    const struct sexp* env = env_exp.env;
-    const struct sexp* exp = env_exp.exp;
-    if (atom(exp)) {
-        if (nil(exp)) {
-            return (struct env_exp){ env, NIL() };
-        } else {
-            return (struct env_exp){ env, find(trap, name_of(exp), env) };
+/*
+ * Expressions in tail position (taken branch of cond, last form of lambda body) are evaluated
+ * by looping here instead of recursion, so tail calls run in constant C stack.
+ * While tracing, they are evaluated by eval_impl to print each of them.
+ */
+static const struct env_exp eval_core(jmp_buf trap, struct env_exp env_exp, struct print_context* print_context) {
+    const bool tail = !print_context->verbose_eval;
+    const struct sexp* caller_env = NULL; // environment resulting from the first application, if any.
+    bool applied = false;
+    struct env_exp result;
+    while (true) {
+        const struct sexp* env = env_exp.env;
+        const struct sexp* exp = env_exp.exp;
+        if (atom(exp)) {
+            if (nil(exp) || is_fixnum(exp)) {
+                result = (struct env_exp){ env, exp };
+            } else if (is_local(exp)) {
+                result = (struct env_exp){ env, local_value(env, exp) };
+            } else {
+                result = (struct env_exp){ env, find(trap, exp, env) };
+            }
+            break;
         }
-    } else {
+
         /* exp is pair */
         const struct sexp* car = fst(exp);
-        
-        if (atom(car)) {
-            if (STR_EQ("quote", name_of(car))) {
-                return (struct env_exp){ env, cadr(trap, exp) };
-            } else if (STR_EQ("cons", name_of(car))) {
-                const struct env_exp head = eval_impl(trap, (struct env_exp){ env, cadr(trap, exp) }, print_context);
-                const struct env_exp tail = eval_impl(trap, (struct env_exp){ head.env, caddr(trap, exp) }, print_context);
-                return (struct env_exp){ tail.env, cons(head.exp, tail.exp) };
-            } else if (STR_EQ("atom", name_of(car))) {
-                const struct env_exp r = eval_impl(trap, (struct env_exp){ env, cadr(trap, exp) }, print_context);
-                if (atom(r.exp)) {
-                    return eval_impl(trap, (struct env_exp){ r.env, symbol("t") }, print_context);
-                } else {
-                    return (struct env_exp){ r.env, NIL() };
-                }
-            } else if (STR_EQ("car", name_of(car))) {
-                const struct env_exp r = eval_impl(trap, (struct env_exp){ env, cadr(trap, exp) }, print_context);
-                return (struct env_exp){ r.env, fst(ensure_pair(trap, r.exp)) };
-            } else if (STR_EQ("cdr", name_of(car))) {
-                const struct env_exp r = eval_impl(trap, (struct env_exp){ env, cadr(trap, exp) }, print_context);
-                return (struct env_exp){ r.env, snd(ensure_pair(trap, r.exp)) };
-            } else if (STR_EQ("set", name_of(car))) {
-                const struct env_exp var = eval_impl(trap, (struct env_exp){ env, cadr(trap, exp) }, print_context);
-                const struct env_exp val = eval_impl(trap, (struct env_exp){ var.env, caddr(trap, exp) }, print_context);
-                const struct sexp* def = cons(var.exp, val.exp);
-                return (struct env_exp){ cons(def, val.env), val.exp };
-            } else if (STR_EQ("cond", name_of(car))) {
-                cadr(trap, exp); // check at least one branch exist.
-                return cond(trap, env, snd(exp), print_context);
-            } else if (STR_EQ("lambda", name_of(car))) {
-                return closure(trap, env, exp);
-            } else {
-                return apply(trap, env_exp, print_context);
+
+        special_form form = atom(car) && !nil(car) ? form_of(car) : NULL;
+
+        if (form == form_cond && tail) {
+            cadr(trap, exp); // check at least one branch exist.
+            if (!branch(trap, env, snd(exp), print_context, &env_exp)) {
+                result = env_exp;
+                break;
+            }
+        } else if (form) {
+            result = form(trap, env_exp, print_context);
+            break;
+        } else if (tail) {
+            const struct sexp* after_args;
+            const struct env_exp callee = enter(trap, env_exp, print_context, &after_args);
+            if (profile.on && applied) {
+                profile_replace(); // caller's call ends here by the tail call.
             }
+            if (!applied) {
+                caller_env = after_args;
+                applied = true;
+            }
+            const struct sexp* body = callee.exp;
+            env = callee.env;
+            if (atom(body)) {
+                result = (struct env_exp){ env, call_body(trap, env, body, print_context) };
+                break;
+            }
+            for (; !atom(snd(body)); body = snd(body)) {
+                env = eval_impl(trap, (struct env_exp){ env, fst(body) }, print_context).env;
+            }
+            env_exp = (struct env_exp){ env, fst(body) };
+        } else {
+            result = apply(trap, env_exp, print_context);
+            break;
+        }
+    }
+    if (applied) {
+        result.env = caller_env;
+        if (profile.on) {
+            profile_leave();
+        }
+    }
+    return result;
+}
+
+const struct env_exp form_quote(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) };
+}
+
+const struct env_exp form_cons(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp head = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    const struct env_exp tail = eval_impl(trap, (struct env_exp){ head.env, caddr(trap, env_exp.exp) }, print_context);
+    return (struct env_exp){ tail.env, cons(head.exp, tail.exp) };
+}
+
+const struct env_exp form_atom(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    if (atom(r.exp)) {
+        return eval_impl(trap, (struct env_exp){ r.env, S.t }, print_context);
+    } else {
+        return (struct env_exp){ r.env, NIL() };
+    }
+}
+
+const struct env_exp form_car(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    return (struct env_exp){ r.env, fst(ensure_pair(trap, r.exp)) };
+}
+
+const struct env_exp form_cdr(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    return (struct env_exp){ r.env, snd(ensure_pair(trap, r.exp)) };
+}
+
+const struct env_exp form_set(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp var = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    const struct env_exp val = eval_impl(trap, (struct env_exp){ var.env, caddr(trap, env_exp.exp) }, print_context);
+    const struct sexp* def = cons(var.exp, val.exp);
+    if (profile.on) {
+        profile_name(var.exp, val.exp);
+    }
+    return (struct env_exp){ cons(def, val.env), val.exp };
+}
+
+const struct env_exp form_cond(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    cadr(trap, env_exp.exp); // check at least one branch exist.
+    return cond(trap, env_exp.env, snd(env_exp.exp), print_context);
+}
+
+const struct env_exp form_lambda(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return closure(trap, env_exp.env, env_exp.exp);
+}
+
+const struct env_exp form_gc(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    collect_garbage();
+    return (struct env_exp){ env_exp.env, NIL() };
+}
+
+/* name of path given to form as (form "path"), which may be quoted by `"`. throw TRAP_ILLARG if it is not symbol. */
+static const char* path_name(jmp_buf trap, const struct sexp* exp) {
+    const struct sexp* name = cadr(trap, exp);
+    if (!is_symbol(name)) {
+        report(Err_illegal_argument, exp);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return name_of(name);
+}
+
+/* copy name into path with quotes around it removed. path must hold strlen(name) + 1 bytes. */
+static void unquote(const char* name, char* path) {
+    const size_t length = strlen(name);
+    if (length >= 2 && name[0] == '"' && name[length - 1] == '"') {
+        memcpy(path, name + 1, length - 2);
+        path[length - 2] = '\0';
+    } else {
+        strcpy(path, name);
+    }
+}
+
+/* (load "path") evaluates expressions in file in turn, and returns the last value. path is not evaluated. */
+const struct env_exp form_load(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const char* name = path_name(trap, env_exp.exp);
+    char path[strlen(name) + 1];
+    unquote(name, path);
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(error_stream(), "Cannot open file: %s", path);
+        fflush(error_stream());
+        longjmp(trap, TRAP_NOFILE);
+    }
+    struct source* const source = open_source(fp);
+    const struct sexp* volatile env = env_exp.env;
+    const struct sexp* volatile value = NIL();
+    jmp_buf trap2;
+    const int code = setjmp(trap2);
+    if (code == TRAP_NONE) {
+        while (true) {
+            const struct env_exp r = eval_impl(trap2, (struct env_exp){ env, read_source(trap2, source) }, print_context);
+            env = r.env;
+            value = r.exp;
+        }
+    }
+    close_source(source);
+    fclose(fp);
+    if (code != TRAP_NOINPUT) {
+        longjmp(trap, code);
+    }
+    return (struct env_exp){ env, value };
+}
+
+/*
+ * (save-image "path") writes the environment and objects reachable from it into image file,
+ * which `load_image` maps back, and returns nil. path is not evaluated.
+ */
+const struct env_exp form_save_image(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const char* name = path_name(trap, env_exp.exp);
+    char path[strlen(name) + 1];
+    unquote(name, path);
+    if (!save_image(path, env_exp.env)) {
+        fprintf(error_stream(), "Cannot write file: %s", path);
+        fflush(error_stream());
+        longjmp(trap, TRAP_NOFILE);
+    }
+    return (struct env_exp){ env_exp.env, NIL() };
+}
+
+/* (write-binary x) writes value of x into stdout in binary form (see `write_binary`), and returns it. */
+const struct env_exp form_write_binary(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    if (!write_binary(binary_stdout(), r.exp)) {
+        fprintf(error_stream(), "Cannot write binary data.");
+        fflush(error_stream());
+        longjmp(trap, TRAP_NOFILE);
+    }
+    return (struct env_exp){ env_exp.env, r.exp };
+}
+
+/* (read-binary) reads expression written by write-binary from stdin. it is an error if no record is left. */
+const struct env_exp form_read_binary(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    jmp_buf trap2;
+    const int code = setjmp(trap2);
+    if (code == TRAP_NONE) {
+        return (struct env_exp){ env_exp.env, read_binary(trap2, binary_stdin()) };
+    }
+    if (code == TRAP_NOINPUT) {
+        fprintf(error_stream(), "Unexpected end of data.");
+        fflush(error_stream());
+        longjmp(trap, TRAP_ILLARG);
+    }
+    longjmp(trap, code);
+}
+
+/* value of exp as integer; throw TRAP_ILLARG if exp is not number. */
+static intptr_t number(jmp_buf trap, const struct sexp* exp) {
+    if (!is_fixnum(exp)) {
+        report(Err_value_not_number, exp);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return fixnum_value(exp);
+}
+
+/* x op y for op of `+`, `-` or `*`; throw TRAP_ILLARG if either is not number or result does not fit in fixnum. */
+static const struct sexp* arithmetic(jmp_buf trap, char op, const struct sexp* x, const struct sexp* y) {
+    const intptr_t a = number(trap, x);
+    const intptr_t b = number(trap, y);
+    intptr_t r;
+    const bool overflow = op == '+' ? __builtin_add_overflow(a, b, &r)
+                        : op == '-' ? __builtin_sub_overflow(a, b, &r)
+                                    : __builtin_mul_overflow(a, b, &r);
+    if (overflow || r < FIXNUM_MIN || FIXNUM_MAX < r) {
+        fprintf(error_stream(), "Integer overflow.");
+        fflush(error_stream());
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return fixnum(r);
+}
+
+/* fold values of arguments by op from left, starting with unit if only one is given; (- x) negates x. */
+static const struct env_exp fold_arithmetic(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context,
+                                            char op, intptr_t unit) {
+    const struct sexp* env = env_exp.env;
+    const struct sexp* acc = NULL; // none of arguments evaluated yet.
+    const struct sexp* xs = snd(env_exp.exp);
+    for (; !atom(xs); xs = snd(xs)) {
+        const struct env_exp x = eval_impl(trap, (struct env_exp){ env, fst(xs) }, print_context);
+        env = x.env;
+        if (acc) {
+            acc = arithmetic(trap, op, acc, x.exp);
+        } else if (op == '-' && atom(snd(xs))) {
+            acc = arithmetic(trap, op, fixnum(0), x.exp);
         } else {
-            return apply(trap, env_exp, print_context);
+            number(trap, x.exp);
+            acc = x.exp;
+        }
+    }
+    if (!nil(xs) || (!acc && op == '-')) {
+        report(Err_illegal_argument, env_exp.exp);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return (struct env_exp){ env, acc ? acc : fixnum(unit) };
+}
+
+const struct env_exp form_add(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return fold_arithmetic(trap, env_exp, print_context, '+', 0);
+}
+
+const struct env_exp form_subtract(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return fold_arithmetic(trap, env_exp, print_context, '-', 0);
+}
+
+const struct env_exp form_multiply(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return fold_arithmetic(trap, env_exp, print_context, '*', 1);
+}
+
+/* (< x y) or (= x y) returns value of `t` if it holds, or nil. */
+static const struct env_exp compare(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context, char op) {
+    const struct env_exp x = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    const struct env_exp y = eval_impl(trap, (struct env_exp){ x.env, caddr(trap, env_exp.exp) }, print_context);
+    const intptr_t a = number(trap, x.exp);
+    const intptr_t b = number(trap, y.exp);
+    if (op == '<' ? a < b : a == b) {
+        return eval_impl(trap, (struct env_exp){ y.env, S.t }, print_context);
+    } else {
+        return (struct env_exp){ y.env, NIL() };
+    }
+}
+
+const struct env_exp form_less(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return compare(trap, env_exp, print_context, '<');
+}
+
+const struct env_exp form_equal(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    return compare(trap, env_exp, print_context, '=');
+}
+
+/* value of `t` if holds, or nil. */
+static const struct sexp* truth(jmp_buf trap, bool holds, const struct sexp* env) {
+    return holds ? find(trap, S.t, env) : NIL();
+}
+
+/* number of elements of proper list xs; throw TRAP_NOTPAIR if it is not. */
+static size_t length_of(jmp_buf trap, const struct sexp* xs) {
+    const struct sexp* rest = xs;
+    size_t n = 0;
+    for (; !atom(rest); rest = snd(rest)) {
+        n += 1;
+    }
+    if (!nil(rest)) {
+        report(Err_value_not_list, xs);
+        longjmp(trap, TRAP_NOTPAIR);
+    }
+    return n;
+}
+
+/* (eq x y) returns value of `t` if x and y are the same object (i.e. the same symbol or number), or nil. */
+static const struct sexp* primitive_eq(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    return truth(trap, args[0] == args[1], env);
+}
+
+/* (null x) returns value of `t` if x is nil, or nil. */
+static const struct sexp* primitive_null(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    return truth(trap, nil(args[0]), env);
+}
+
+/* (list x ...) returns list of arguments. */
+static const struct sexp* primitive_list(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    return list_from(n, args, NIL());
+}
+
+/* (append xs ... ys) returns list of elements of lists xs ... followed by ys, which is shared. */
+static const struct sexp* primitive_append(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    size_t length = 0;
+    unsigned i;
+    if (n == 0) {
+        return NIL();
+    }
+    for (i = 0; i + 1 < n; ++i) {
+        length += length_of(trap, args[i]);
+    }
+    const struct sexp** elements = malloc(sizeof(*elements) * (length + 1)); // kept alive by args.
+    const struct sexp* xs;
+    length = 0;
+    for (i = 0; i + 1 < n; ++i) {
+        for (xs = args[i]; !atom(xs); xs = snd(xs)) {
+            elements[length++] = fst(xs);
+        }
+    }
+    const struct sexp* appended = list_from(length, elements, args[n - 1]);
+    free(elements);
+    return appended;
+}
+
+/* (reverse xs) returns list of elements of xs in reverse order. */
+static const struct sexp* primitive_reverse(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    const size_t length = length_of(trap, args[0]);
+    const struct sexp** elements = malloc(sizeof(*elements) * (length + 1)); // kept alive by args.
+    const struct sexp* xs;
+    size_t i = length;
+    for (xs = args[0]; !atom(xs); xs = snd(xs)) {
+        elements[--i] = fst(xs);
+    }
+    const struct sexp* reversed = list_from(length, elements, NIL());
+    free(elements);
+    return reversed;
+}
+
+/* (length xs) returns number of elements of xs. */
+static const struct sexp* primitive_length(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    return fixnum(length_of(trap, args[0]));
+}
+
+/* (assoc key alist) returns the first pair of alist whose car has the same structure as key, or nil. */
+static const struct sexp* primitive_assoc(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    const struct sexp* xs = args[1];
+    for (; !atom(xs); xs = snd(xs)) {
+        const struct sexp* entry = fst(xs);
+        if (!atom(entry) && equal(fst(entry), args[0])) {
+            return entry;
         }
     }
+    if (!nil(xs)) {
+        report(Err_value_not_list, args[1]);
+        longjmp(trap, TRAP_NOTPAIR);
+    }
+    return NIL();
+}
+
+/* (nth i xs) returns i-th element of xs counting from 0, or nil if xs is shorter. */
+static const struct sexp* primitive_nth(jmp_buf trap, const struct sexp* const* args, unsigned n, const struct sexp* env) {
+    intptr_t i = number(trap, args[0]);
+    const struct sexp* xs = args[1];
+    if (i < 0) {
+        report(Err_illegal_argument, args[0]);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    for (; i > 0 && !atom(xs); --i) {
+        xs = snd(xs);
+    }
+    return atom(xs) ? NIL() : fst(xs);
+}
+
+static const struct primitive_entry primitives[NUM_PRIMITIVES] = {
+    { "eq", primitive_eq, 2, 2 },
+    { "null", primitive_null, 1, 1 },
+    { "list", primitive_list, 0, UINT_MAX },
+    { "append", primitive_append, 0, UINT_MAX },
+    { "reverse", primitive_reverse, 1, 1 },
+    { "length", primitive_length, 1, 1 },
+    { "assoc", primitive_assoc, 2, 2 },
+    { "nth", primitive_nth, 2, 2 },
+};
+
+/* index of primitive named sym in `primitives`, or NUM_PRIMITIVES if sym does not name any. */
+static unsigned primitive_of(const struct sexp* sym) {
+    unsigned k = 0;
+    while (k < NUM_PRIMITIVES && S.primitives[k] != sym) {
+        k += 1;
+    }
+    return k;
+}
+
+/* value of primitive p applied to n values, called from an expression in env; throw TRAP_ILLARG if it does not take n. */
+static const struct sexp* apply_primitive(jmp_buf trap, const struct primitive_entry* p, const struct sexp* const* values, unsigned n,
+                                          const struct sexp* env) {
+    if (n < p->min || n > p->max) {
+        fprintf(error_stream(), "List length mismatch.");
+        fflush(error_stream());
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return p->f(trap, values, n, env);
+}
+
+/* value of primitive p applied to list of args, called from an expression in env. */
+static const struct sexp* call_primitive(jmp_buf trap, const struct primitive_entry* p, const struct sexp* args, const struct sexp* env) {
+    const struct sexp* values[length_of(trap, args) + 1];
+    unsigned n = 0;
+    for (; !atom(args); args = snd(args)) {
+        values[n++] = fst(args);
+    }
+    return apply_primitive(trap, p, values, n, env);
+}
+
+/* applied with list of arguments by call_native, which passes environment of the call site instead. */
+static const struct sexp* primitive_native(jmp_buf trap, const struct sexp* args, void* data) {
+    return call_primitive(trap, data, args, NIL());
 }
 
-const struct sexp* find(jmp_buf trap, const char* name, const struct sexp* env) {
-    if (atom(env)) {
-        fprintf(stderr, Err_value_not_found, name);
-        fflush(stderr);
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* (time expr) returns value of expr, writing time and counters spent by it into error stream. */
+const struct env_exp form_time(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct sexp* exp = cadr(trap, env_exp.exp);
+    const struct eval_stats before = eval_stats();
+    const double wall = seconds(CLOCK_MONOTONIC);
+    const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, exp }, print_context);
+    const struct eval_stats after = eval_stats();
+    fprintf(error_stream(), "time: %.3f ms wall, %.3f ms cpu, %zu evals, %zu calls, %zu conses, %zu links\n",
+            (seconds(CLOCK_MONOTONIC) - wall) * 1e3, (seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu) * 1e3,
+            after.evals - before.evals, after.calls - before.calls, after.conses - before.conses, after.links - before.links);
+    fflush(error_stream());
+    return r;
+}
+
+const struct sexp* find(jmp_buf trap, const struct sexp* sym, const struct sexp* env) {
+    const struct sexp* value;
+    if (!lookup(sym, env, &value)) {
+        const unsigned k = primitive_of(sym);
+        if (k < NUM_PRIMITIVES) {
+            return S.builtins[k]; // built-in function, unless defined.
+        }
+        fprintf(error_stream(), Err_value_not_found, name_of(sym));
+        fflush(error_stream());
         longjmp(trap, TRAP_NOSYM);
     } else {
-        const struct sexp* def = fst(env);
-        if (STR_EQ(name, name_of(fst(def)))) {
-            return snd(def); // value
+        return value;
+    }
+}
+
+bool lookup(const struct sexp* sym, const struct sexp* env, const struct sexp** value) {
+    while (!nil(env)) {
+        counters.links += 1;
+        if (!atom(env)) {
+            return lookup_defs(sym, env, value);
+        } else if (is_frame(env)) {
+            const struct sexp* params = frame_params(env);
+            size_t slot = 0;
+            for (; !atom(params); params = snd(params), ++slot) {
+                if (sym == fst(params)) {
+                    *value = frame_value(env, slot);
+                    return true;
+                }
+            }
+            if (sym == params) {
+                *value = frame_value(env, slot);
+                return true;
+            }
+            if (lookup(sym, frame_captured(env), value)) {
+                return true;
+            }
+            env = frame_global(env);
         } else {
-            return find(trap, name, snd(env));
+            break;
+        }
+    }
+    return false;
+}
+
+bool lookup_defs(const struct sexp* sym, const struct sexp* defs, const struct sexp** value) {
+    struct cache_entry* entry = cache + ((((size_t) sym ^ (size_t) defs) >> 4) * 2654435761u >> 8 & (CACHE_SIZE - 1));
+    if (entry->symbol != sym || entry->defs != defs) {
+        const struct sexp* env = defs;
+        const struct sexp* found = NIL();
+        for (; !atom(env); env = snd(env)) {
+            const struct sexp* def = fst(env);
+            counters.links += 1;
+            if (sym == fst(def)) {
+                found = snd(def);
+                break;
+            }
         }
+        /* the rest may be a frame; lookup there can reuse the entry, so fill it after. */
+        const bool hit = !atom(env) || lookup(sym, env, &found);
+        *entry = (struct cache_entry){ sym, defs, found, hit };
     }
+    *value = entry->value;
+    return entry->found;
 }
 
+
 const struct sexp* cadr(jmp_buf trap, const struct sexp* exp) {
     return leaf(trap, exp, (leaf_iterator[]) {snd, fst, 0});
 }
@@ -200,10 +1128,7 @@ const struct sexp* leaf(jmp_buf trap, const struct sexp* exp, leaf_iterator* ite
     if (*iter) {
         const struct sexp* next = (*iter)(exp);
         if (*(iter + 1) && atom(next)) {
-            char* p = text(exp);
-            fprintf(stderr, Err_illegal_argument, p);
-            fflush(stderr);
-            free(p);
+            report(Err_illegal_argument, exp);
             longjmp(trap, TRAP_ILLARG);
         } else {
             return leaf(trap, next, iter + 1);
@@ -215,8 +1140,7 @@ const struct sexp* leaf(jmp_buf trap, const struct sexp* exp, leaf_iterator* ite
 
 const struct sexp* ensure_pair(jmp_buf trap, const struct sexp* exp) {
     if (atom(exp)) {
-        fprintf(stderr, Err_value_not_pair, text(exp));
-        fflush(stderr);
+        report(Err_value_not_pair, exp);
         longjmp(trap, TRAP_NOTPAIR);
     } else {
         return exp;
@@ -224,51 +1148,74 @@ const struct sexp* ensure_pair(jmp_buf trap, const struct sexp* exp) {
 }
 
 const struct env_exp cond(jmp_buf trap, const struct sexp* env, const struct sexp* cond_cdr, struct print_context* print_context) {
-    if (atom(cond_cdr)) {
-        if (nil(cond_cdr)) {
-            return (struct env_exp){ env, cond_cdr };
-        } else {
-            fprintf(stderr, Err_illegal_argument, text(cond_cdr));
-            fflush(stderr);
-            longjmp(trap, TRAP_ILLARG);
-        }
+    struct env_exp taken;
+    if (branch(trap, env, cond_cdr, print_context, &taken)) {
+        return eval_impl(trap, taken, print_context);
     } else {
-        const struct sexp* branch = fst(ensure_pair(trap, cond_cdr));
-        const struct env_exp pred = eval_impl(trap, (struct env_exp){ env, fst(ensure_pair(trap, branch)) }, print_context);
-        if (nil(pred.exp)) {
-            return cond(trap, pred.env, snd(cond_cdr), print_context);
-        } else {
-            return eval_impl(trap, (struct env_exp){ pred.env, cadr(trap, branch) }, print_context);
-        }
+        return taken;
     }
 }
 
+bool branch(jmp_buf trap, const struct sexp* env, const struct sexp* cond_cdr, struct print_context* print_context,
+            struct env_exp* taken) {
+    for (; !atom(cond_cdr); cond_cdr = snd(cond_cdr)) {
+        const struct sexp* clause = fst(cond_cdr);
+        const struct env_exp pred = eval_impl(trap, (struct env_exp){ env, fst(ensure_pair(trap, clause)) }, print_context);
+        if (!nil(pred.exp)) {
+            *taken = (struct env_exp){ pred.env, cadr(trap, clause) };
+            return true;
+        }
+        env = pred.env;
+    }
+    if (!nil(cond_cdr)) {
+        report(Err_illegal_argument, cond_cdr);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    *taken = (struct env_exp){ env, cond_cdr };
+    return false;
+}
+
 const struct env_exp closure(jmp_buf trap, const struct sexp* env, const struct sexp* exp) {
     const struct sexp* lambda_cdr = snd(exp);
     if (atom(lambda_cdr)) {
-        fprintf(stderr, "No closure param exist: %s", text(exp));
-        fflush(stderr);
+        report("No closure param exist: %s", exp);
         longjmp(trap, TRAP_ILLARG);
     } else {
         const struct sexp* param = fst(lambda_cdr);
         const struct sexp* body = snd(lambda_cdr);
         if (atom(param) && !nil(param)) {
-            fprintf(stderr, "Closure parameter should be list: %s", text(exp));
-            fflush(stderr);
+            report("Closure parameter should be list: %s", exp);
             longjmp(trap, TRAP_ILLARG);
         } else {
+            if (!binds(body)) {
+                const struct scope scope = { param, NULL };
+                body = resolve(body, &scope);
+                const struct sexp* code = compiling ? compile(body) : NULL;
+                if (code) {
+                    body = code;
+                }
+            }
             return (struct env_exp){ env, make_applicable(env, param, body) };
         }
     }
 }
 
 const struct env_exp apply(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct sexp* env;
+    const struct env_exp callee = enter(trap, env_exp, print_context, &env);
+    const struct sexp* value = call_body(trap, callee.env, callee.exp, print_context);
+    if (profile.on) {
+        profile_leave();
+    }
+    return (struct env_exp){ env, value };
+}
+
+const struct env_exp enter(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context,
+                           const struct sexp** env) {
     const struct env_exp evaluated = map_eval(trap, env_exp, print_context);
-    const struct sexp* env = evaluated.env;
     const struct sexp* exp = evaluated.exp;
     if (atom(exp)) {
-        fprintf(stderr, Err_illegal_argument, text(env_exp.exp));
-        fflush(stderr);
+        report(Err_illegal_argument, env_exp.exp);
         longjmp(trap, TRAP_ILLARG);
     } else {
         const struct sexp* func = fst(exp);
@@ -276,16 +1223,89 @@ const struct env_exp apply(jmp_buf trap, const struct env_exp env_exp, struct pr
         const struct sexp* closed_env = get_environment(trap, func);
         const struct sexp* pars = get_params(trap, func);
         const struct sexp* body = get_body(trap, func);
-        jmp_buf trap2;
-        if (setjmp(trap2)) {
-            fprintf(stderr, ": %s v.s. %s", text(pars), text(args));
-            fflush(stderr);
+        if (is_code(body) && print_context->verbose_eval) {
+            body = code_body(body); // traced by tree walker.
+        }
+        /* the callee sees top level definitions of the call site, but not its locals. */
+        *env = evaluated.env;
+        const struct sexp* frame = bind(trap, pars, args, closed_env, call_site_global(env_exp.env));
+        if (profile.on) {
+            profile_enter(func);
+        }
+        return (struct env_exp){ frame, body };
+    }
+}
+
+const struct sexp* call(jmp_buf trap, const struct sexp* func, const struct sexp* args, const struct sexp* global,
+                        struct print_context* print_context) {
+    const struct sexp* frame = bind(trap, get_params(trap, func), args, get_environment(trap, func), global);
+    if (profile.on) {
+        profile_enter(func);
+    }
+    const struct sexp* value = call_body(trap, frame, get_body(trap, func), print_context);
+    if (profile.on) {
+        profile_leave();
+    }
+    return value;
+}
+
+/* value of function of host for arguments bound in frame. */
+static const struct sexp* call_native(jmp_buf trap, const struct sexp* frame, const struct sexp* native) {
+    const struct sexp* args = frame_value(frame, 0);
+    int arity;
+    void* data;
+    const native_function f = native_of(native, &arity, &data);
+    if (!f) {
+        report("Native function `%s` is not defined.", native_name(native));
+        longjmp(trap, TRAP_NOTAPPLICABLE);
+    }
+    if (f == primitive_native) {
+        return call_primitive(trap, data, args, frame_global(frame)); // finds `t` at the call site.
+    }
+    if (arity >= 0) {
+        const struct sexp* xs = args;
+        int n = 0;
+        for (; !atom(xs) && n <= arity; xs = snd(xs)) {
+            n += 1;
+        }
+        if (n != arity) {
+            fprintf(error_stream(), "List length mismatch.");
+            fflush(error_stream());
             longjmp(trap, TRAP_ILLARG);
-        } else {
-            const struct sexp* es = append_defs(env_exp.env, append_defs(closed_env, zip(trap, pars, args)));
-            return (struct env_exp){ env, fold_eval(trap, (struct env_exp){ es, body }, NIL(), print_context) };
         }
     }
+    return f(trap, args, data);
+}
+
+/*
+ * value of memoized applicable for arguments bound in frame, calling the applicable it wraps unless memoized.
+ * memo of another thread (i.e. called in pmap) is left as it is, and the applicable is always called.
+ */
+static const struct sexp* call_memo(jmp_buf trap, const struct sexp* frame, const struct sexp* memo, struct print_context* print_context) {
+    const struct sexp* args = frame_value(frame, 0);
+    const struct sexp* value;
+    if (!gc_owned(memo)) {
+        return call(trap, memo_func(memo), args, frame_global(frame), print_context);
+    }
+    if (!memo_get(memo, args, &value)) {
+        value = call(trap, memo_func(memo), args, frame_global(frame), print_context);
+        memo_put(memo, args, value);
+    }
+    return value;
+}
+
+const struct sexp* call_body(jmp_buf trap, const struct sexp* frame, const struct sexp* body, struct print_context* print_context) {
+    if (is_code(body) && !print_context->verbose_eval) {
+        return run(trap, frame, body, print_context);
+    } else if (is_code(body)) {
+        return fold_eval(trap, (struct env_exp){ frame, code_body(body) }, NIL(), print_context); // traced by tree walker.
+    } else if (is_memo(body)) {
+        return call_memo(trap, frame, body, print_context);
+    } else if (is_native(body)) {
+        return call_native(trap, frame, body);
+    } else {
+        return fold_eval(trap, (struct env_exp){ frame, body }, NIL(), print_context);
+    }
 }
 
 const struct env_exp map_eval(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
@@ -310,24 +1330,939 @@ const struct sexp* fold_eval(jmp_buf trap, const struct env_exp env_xs, const st
     }
 }
 
-const struct sexp* zip(jmp_buf trap, const struct sexp* xs, const struct sexp* ys) {
-    if (atom(xs) && atom(ys)) {
-        return nil(xs) && nil(ys) ? NIL() : cons(xs, ys);
+static const struct sexp* call_site_global(const struct sexp* env) {
+    const struct sexp* frame = env;
+    while (!atom(frame)) {
+        frame = snd(frame); // definitions made in the body of frame.
+    }
+    return is_frame(frame) ? frame_global(frame) : env;
+}
+
+static const struct sexp* bind(jmp_buf trap, const struct sexp* pars, const struct sexp* args,
+                               const struct sexp* captured, const struct sexp* global) {
+    counters.calls += 1;
+    size_t size = 0;
+    const struct sexp* xs = pars;
+    const struct sexp* ys = args;
+    for (; !atom(xs) && !atom(ys); xs = snd(xs), ys = snd(ys)) {
+        size += 1;
+    }
+    if (!atom(xs) || (nil(xs) && !atom(ys))) {
+        fprintf(error_stream(), "List length mismatch.");
+        report(": %s", pars);
+        report(" v.s. %s", args);
+        longjmp(trap, TRAP_ILLARG);
+    }
+
+    const struct sexp* values[size + 1];
+    size = 0;
+    for (xs = pars, ys = args; !atom(xs); xs = snd(xs), ys = snd(ys)) {
+        values[size++] = fst(ys);
+    }
+    if (!nil(xs)) {
+        values[size++] = ys; // dotted parameter takes rest.
+    }
+    return make_frame(pars, values, size, captured, global);
+}
+
+/*
+ * Profiler.
+ */
+
+/* entry of applicable func, made if not yet. */
+static struct profile_entry* profile_entry(const struct sexp* func) {
+    const struct sexp* body = get_body(NULL, func); // func is applicable, so never throws.
+    if (2 * (profile.count + 1) > profile.capacity) {
+        const size_t capacity = profile.capacity ? profile.capacity * 2 : 64;
+        size_t* index = calloc(capacity, sizeof(size_t));
+        size_t i;
+        for (i = 0; i < profile.count; ++i) {
+            size_t j = ((size_t) profile.entries[i].body >> 3) * 2654435761u & (capacity - 1);
+            while (index[j]) {
+                j = (j + 1) & (capacity - 1);
+            }
+            index[j] = i + 1;
+        }
+        free(profile.index);
+        profile.index = index;
+        profile.capacity = capacity;
+        profile.entries = realloc(profile.entries, sizeof(*profile.entries) * capacity / 2);
+    }
+    size_t j = ((size_t) body >> 3) * 2654435761u & (profile.capacity - 1);
+    while (profile.index[j] && profile.entries[profile.index[j] - 1].body != body) {
+        j = (j + 1) & (profile.capacity - 1);
+    }
+    if (!profile.index[j]) {
+        const struct sexp* params = get_params(NULL, func);
+        profile.keep = cons(cons(body, params), profile.keep);
+        profile.entries[profile.count] = (struct profile_entry){ .body = body, .params = params };
+        profile.index[j] = ++profile.count;
+    }
+    return profile.entries + profile.index[j] - 1;
+}
+
+void profile_enter(const struct sexp* func) {
+    struct profile_entry* entry = profile_entry(func);
+    entry->calls += 1;
+    entry->active += 1;
+    if (profile.depth == profile.stack_capacity) {
+        profile.stack_capacity = profile.stack_capacity ? profile.stack_capacity * 2 : 256;
+        profile.stack = realloc(profile.stack, sizeof(*profile.stack) * profile.stack_capacity);
+    }
+    profile.stack[profile.depth++] = (struct profile_call){ entry - profile.entries, seconds(CLOCK_MONOTONIC), 0 };
+}
+
+/* finish call at depth i; inclusive time of recursive calls is taken by the outermost one. */
+static void profile_finish(size_t i) {
+    const struct profile_call* call = profile.stack + i;
+    struct profile_entry* entry = profile.entries + call->entry;
+    const double total = seconds(CLOCK_MONOTONIC) - call->start;
+    entry->self += total - call->children;
+    if (!--entry->active) {
+        entry->total += total;
+    }
+    if (i) {
+        profile.stack[i - 1].children += total;
+    }
+}
+
+void profile_leave() {
+    if (profile.depth) {
+        profile_finish(--profile.depth);
+    }
+}
+
+void profile_replace() {
+    if (profile.depth >= 2) {
+        struct profile_call callee = profile.stack[profile.depth - 1];
+        const struct profile_call* caller = profile.stack + profile.depth - 2;
+        if (callee.entry == caller->entry) {
+            /* loop by self tail call is one long call. */
+            callee.start = caller->start;
+            callee.children += caller->children;
+            profile.entries[callee.entry].active -= 1;
+        } else {
+            profile_finish(profile.depth - 2);
+        }
+        profile.stack[profile.depth - 2] = callee;
+        profile.depth -= 1;
+    }
+}
+
+void profile_name(const struct sexp* sym, const struct sexp* value) {
+    if (is_symbol(sym) && is_applicable(value)) {
+        struct profile_entry* entry = profile_entry(value);
+        entry->name = sym;
+        profile.keep = cons(sym, profile.keep);
+    }
+}
+
+/* name of entry; set symbol, or source of lambda. You must free returned string. */
+static char* profile_label(const struct profile_entry* entry) {
+    if (entry->name) {
+        return strdup(name_of(entry->name));
+    }
+    const struct sexp* body = is_code(entry->body) ? code_body(entry->body) : entry->body;
+    char* p = text(cons(symbol("lambda"), cons(entry->params, body)));
+    if (strlen(p) > 60) {
+        strcpy(p + 56, " ...");
+    }
+    return p;
+}
+
+struct profile_line {
+    char* label;
+    size_t calls;
+    double total;
+    double self;
+};
+
+static int by_label(const void* a, const void* b) {
+    return strcmp(((const struct profile_line*) a)->label, ((const struct profile_line*) b)->label);
+}
+
+static int by_self(const void* a, const void* b) {
+    const double x = ((const struct profile_line*) a)->self;
+    const double y = ((const struct profile_line*) b)->self;
+    return (x < y) - (x > y);
+}
+
+void set_profiling(bool on) {
+    profile.forced = on;
+}
+
+void profile_report(FILE* fp) {
+    if (!profile.count) {
+        return;
+    }
+    struct profile_line* lines = malloc(sizeof(*lines) * profile.count);
+    size_t i, n = 0;
+    for (i = 0; i < profile.count; ++i) {
+        const struct profile_entry* entry = profile.entries + i;
+        lines[i] = (struct profile_line){ profile_label(entry), entry->calls, entry->total, entry->self };
+    }
+    /* closures made from the same lambda have their own bodies, but are reported as one. */
+    qsort(lines, profile.count, sizeof(*lines), by_label);
+    for (i = 0; i < profile.count; ++i) {
+        if (n && !strcmp(lines[n - 1].label, lines[i].label)) {
+            lines[n - 1].calls += lines[i].calls;
+            lines[n - 1].total += lines[i].total;
+            lines[n - 1].self += lines[i].self;
+            free(lines[i].label);
+        } else {
+            lines[n++] = lines[i];
+        }
+    }
+    qsort(lines, n, sizeof(*lines), by_self);
+    fprintf(fp, "%10s %12s %12s  %s\n", "calls", "total ms", "self ms", "name");
+    for (i = 0; i < n; ++i) {
+        fprintf(fp, "%10zu %12.3f %12.3f  %s\n", lines[i].calls, lines[i].total * 1e3, lines[i].self * 1e3, lines[i].label);
+        free(lines[i].label);
+    }
+    fflush(fp);
+    free(lines);
+}
+
+/* memo of function value of (memo func [capacity]); throw TRAP_ILLARG if it is not. */
+static const struct sexp* memo_of(jmp_buf trap, const struct sexp* form, const struct sexp* func) {
+    if (!is_applicable(func) || !is_memo(get_body(trap, func))) {
+        report(Err_illegal_argument, form);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    return get_body(trap, func);
+}
+
+/*
+ * (memo f [capacity]) returns applicable which calls f, memoizing results by structure of arguments.
+ * At most capacity (256 by default) results are kept, and the least recently used one is dropped first.
+ */
+const struct env_exp form_memo(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp f = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    struct env_exp capacity = { f.env, fixnum(256) };
+    if (!atom(snd(snd(env_exp.exp)))) {
+        capacity = eval_impl(trap, (struct env_exp){ f.env, caddr(trap, env_exp.exp) }, print_context);
+    }
+    if (!is_applicable(f.exp) || !is_fixnum(capacity.exp) || fixnum_value(capacity.exp) < 1 || fixnum_value(capacity.exp) > (1 << 20)) {
+        report(Err_illegal_argument, env_exp.exp);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    const struct sexp* memo = make_memo(f.exp, fixnum_value(capacity.exp));
+    return (struct env_exp){ capacity.env, make_applicable(NIL(), S.arguments, memo) };
+}
+
+/* (memo-stats m) returns (hits misses count capacity) of memoized applicable m. */
+const struct env_exp form_memo_stats(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp m = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    size_t stats[4];
+    memo_stats(memo_of(trap, env_exp.exp, m.exp), stats);
+    const struct sexp* xs = NIL();
+    unsigned i = 4;
+    while (i--) {
+        xs = cons(fixnum(stats[i]), xs);
+    }
+    return (struct env_exp){ m.env, xs };
+}
+
+/* (profile) writes profile report into error stream, and returns nil. */
+const struct env_exp form_profile(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    profile_report(error_stream());
+    return (struct env_exp){ env_exp.env, NIL() };
+}
+
+/*
+ * Parallel map.
+ *
+ * Chunks of the list are run on workers of pool (see pool.c), each of which has its own heap.
+ * A worker runs as guest of the calling thread: it looks up symbols and special forms of the caller,
+ * and reads its objects, which are immutable, while the caller waits. So the function and the list
+ * are shared, not copied. Values are allocated by workers, and copied by the caller when all are done.
+ */
+#define PMAP_CHUNK 16
+
+struct pmap {
+    const struct sexp* func;
+    const struct sexp* global;
+    const struct sexp** items;      /* elements of the list, in order. */
+    size_t length;
+    size_t chunk;                   /* elements per chunk. */
+    typeof(S) S;                    /* state of the caller borrowed by workers. */
+    typeof(forms) forms;
+    const void* symbols;
+    const struct sexp** results;    /* list of values of each chunk, allocated by the worker which ran it. */
+    int* codes;                     /* trap code of each chunk failed. */
+    char** errors;                  /* error message of each chunk failed. */
+    const struct sexp* value;       /* list of all values, allocated by the caller. */
+};
+
+/* state of pool worker; `held` keeps values of chunks run until they are collected. */
+static _Thread_local struct {
+    bool rooted;
+    const struct sexp* held;
+} guest;
+
+static void pmap_enter(void* arg) {
+    const struct pmap* pmap = arg;
+    if (!guest.rooted) {
+        size_t i;
+        gc_root(&guest.held);
+        for (i = 0; i < CACHE_SIZE; ++i) {
+            gc_root(&cache[i].symbol);
+            gc_root(&cache[i].defs);
+            gc_root(&cache[i].value);
+        }
+        guest.rooted = true;
+    }
+    S = pmap->S;
+    forms = pmap->forms;
+    borrow_symbols(pmap->symbols);
+}
+
+static bool pmap_run(void* arg, size_t chunk) {
+    struct pmap* pmap = arg;
+    struct print_context print_context = { 0 };
+    const size_t begin = chunk * pmap->chunk;
+    const size_t end = begin + pmap->chunk < pmap->length ? begin + pmap->chunk : pmap->length;
+    char* message = NULL;
+    size_t size;
+    FILE* errors = open_memstream(&message, &size);
+    set_error_stream(errors);
+    jmp_buf trap;
+    const int code = setjmp(trap);
+    if (code == TRAP_NONE) {
+        const struct sexp* values = NIL();
+        const struct sexp* xs = NIL();
+        size_t i;
+        for (i = begin; i < end; ++i) {
+            values = cons(call(trap, pmap->func, cons(pmap->items[i], NIL()), pmap->global, &print_context), values);
+        }
+        for (; !nil(values); values = snd(values)) {
+            xs = cons(fst(values), xs);
+        }
+        pmap->results[chunk] = xs;
+        guest.held = cons(xs, guest.held);
+    }
+    set_error_stream(NULL);
+    fclose(errors);
+    if (code) {
+        pmap->codes[chunk] = code;
+        pmap->errors[chunk] = message;
     } else {
-        if (!atom(xs) && !atom(ys)) {
-            return cons(cons(fst(xs), fst(ys)), zip(trap, snd(xs), snd(ys)));
+        free(message);
+    }
+    return !code;
+}
+
+static void pmap_collect(void* arg) {
+    struct pmap* pmap = arg;
+    const size_t chunks = (pmap->length + pmap->chunk - 1) / pmap->chunk;
+    const struct sexp** values = malloc(sizeof(*values) * pmap->length);
+    size_t i, n = 0;
+    gc_pause(true); // values are referred only from the array until they are linked.
+    for (i = 0; i < chunks; ++i) {
+        const struct sexp* xs = copy_foreign(pmap->results[i]);
+        for (; !atom(xs); xs = snd(xs)) {
+            values[n++] = fst(xs);
+        }
+    }
+    pmap->value = NIL();
+    while (n--) {
+        pmap->value = cons(values[n], pmap->value);
+    }
+    gc_pause(false);
+    free(values);
+}
+
+static void pmap_leave(void* arg) {
+    guest.held = NIL();
+    memset(cache, 0, sizeof(cache));
+    memset(&S, 0, sizeof(S));
+    memset(&forms, 0, sizeof(forms));
+    borrow_symbols(NULL);
+}
+
+/*
+ * (pmap f xs [chunk]) returns list of values of f applied to each element of list xs, in order.
+ *
+ * Elements are applied in chunks of `chunk` (16 by default) elements, run in parallel by pool workers;
+ * a list of one chunk, or one mapped while tracing or profiling, or by a worker, is mapped in turn here.
+ * f should not depend on the order of applications; only the error of the first chunk failed is thrown.
+ */
+const struct env_exp form_pmap(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp f = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    const struct env_exp xs = eval_impl(trap, (struct env_exp){ f.env, caddr(trap, env_exp.exp) }, print_context);
+    struct env_exp chunk = { xs.env, fixnum(PMAP_CHUNK) };
+    if (!atom(snd(snd(snd(env_exp.exp))))) {
+        chunk = eval_impl(trap, (struct env_exp){ xs.env, fst(snd(snd(snd(env_exp.exp)))) }, print_context);
+    }
+    size_t length = 0;
+    const struct sexp* rest = xs.exp;
+    for (; !atom(rest); rest = snd(rest)) {
+        length += 1;
+    }
+    if (!is_applicable(f.exp) || !nil(rest) || !is_fixnum(chunk.exp) || fixnum_value(chunk.exp) < 1) {
+        report(Err_illegal_argument, env_exp.exp);
+        longjmp(trap, TRAP_ILLARG);
+    }
+    const struct sexp* global = call_site_global(env_exp.env);
+
+    if (length <= (size_t) fixnum_value(chunk.exp) || print_context->verbose_eval || profile.on || pool_worker() || pool_size() < 2) {
+        const struct sexp* values = NIL();
+        const struct sexp* ys = NIL();
+        for (rest = xs.exp; !atom(rest); rest = snd(rest)) {
+            values = cons(call(trap, f.exp, cons(fst(rest), NIL()), global, print_context), values);
+        }
+        for (; !nil(values); values = snd(values)) {
+            ys = cons(fst(values), ys);
+        }
+        return (struct env_exp){ chunk.env, ys };
+    }
+
+    const size_t chunks = (length + fixnum_value(chunk.exp) - 1) / fixnum_value(chunk.exp);
+    struct pmap pmap = {
+        .func = f.exp,
+        .global = global,
+        .items = malloc(sizeof(*pmap.items) * length),
+        .length = length,
+        .chunk = fixnum_value(chunk.exp),
+        .S = S,
+        .forms = forms,
+        .symbols = symbol_table(),
+        .results = calloc(chunks, sizeof(*pmap.results)),
+        .codes = calloc(chunks, sizeof(*pmap.codes)),
+        .errors = calloc(chunks, sizeof(*pmap.errors)),
+    };
+    size_t i = 0;
+    for (rest = xs.exp; !atom(rest); rest = snd(rest)) {
+        pmap.items[i++] = fst(rest);
+    }
+    const size_t failed = pool_run(chunks, &pmap, pmap_enter, pmap_run, pmap_collect, pmap_leave);
+    const int code = failed < chunks ? pmap.codes[failed] : TRAP_NONE;
+    if (code) {
+        fputs(pmap.errors[failed], error_stream());
+        fflush(error_stream());
+    }
+    for (i = 0; i < chunks; ++i) {
+        free(pmap.errors[i]);
+    }
+    free(pmap.items);
+    free(pmap.results);
+    free(pmap.codes);
+    free(pmap.errors);
+    if (code) {
+        longjmp(trap, code);
+    }
+    return (struct env_exp){ chunk.env, pmap.value };
+}
+
+/*
+ * Lexical addressing.
+ *
+ * When body of lambda never extends its environment (i.e. has no binding form like `set`),
+ * environment of the body is always the frame made by `bind`. So variable references are
+ * resolved to (depth, slot) of frames once at closure creation.
+ */
+
+static const struct sexp* resolve_symbol(const struct sexp* sym, const struct scope* scope) {
+    unsigned depth;
+    for (depth = 0; scope; scope = scope->outer, ++depth) {
+        const struct sexp* params = scope->params;
+        unsigned slot = 0;
+        for (; !atom(params); params = snd(params), ++slot) {
+            if (sym == fst(params)) {
+                return make_local(sym, depth, slot);
+            }
+        }
+        if (sym == params) {
+            return make_local(sym, depth, slot);
+        }
+    }
+    return sym;
+}
+
+/* resolve each element of list exp; dotted tail is not evaluated so left as is. */
+static const struct sexp* resolve_list(const struct sexp* exp, const struct scope* scope) {
+    if (atom(exp)) {
+        return exp;
+    } else {
+        const struct sexp* x = resolve(fst(exp), scope);
+        const struct sexp* xs = resolve_list(snd(exp), scope);
+        return x == fst(exp) && xs == snd(exp) ? exp : cons(x, xs);
+    }
+}
+
+const struct sexp* resolve(const struct sexp* exp, const struct scope* scope) {
+    if (atom(exp)) {
+        return is_symbol(exp) ? resolve_symbol(exp, scope) : exp;
+    } else {
+        const struct sexp* car = fst(exp);
+        special_form form = is_symbol(car) ? form_of(car) : NULL;
+        if (form == form_quote) {
+            return exp;
+        } else if (form == form_lambda) {
+            const struct sexp* lambda_cdr = snd(exp);
+            if (atom(lambda_cdr) || (atom(fst(lambda_cdr)) && !nil(fst(lambda_cdr)))) {
+                return exp; // malformed, left to be reported by closure.
+            } else {
+                const struct scope inner = { fst(lambda_cdr), scope };
+                const struct sexp* body = resolve_list(snd(lambda_cdr), &inner);
+                return body == snd(lambda_cdr) ? exp : cons(car, cons(fst(lambda_cdr), body));
+            }
+        } else if (form) {
+            const struct sexp* args = resolve_list(snd(exp), scope);
+            return args == snd(exp) ? exp : cons(car, args);
         } else {
-            fprintf(stderr, "List length mismatch.");
-            fflush(stderr);
-            longjmp(trap, TRAP_ILLARG);
+            return resolve_list(exp, scope);
         }
     }
 }
 
-const struct sexp* append_defs(const struct sexp* env, const struct sexp* def) {
-    if (atom(def)) {
-        return nil(def) ? env : cons(def, env);
+/* test whether exp has a binding form anywhere except in quote. */
+bool binds(const struct sexp* exp) {
+    if (atom(exp)) {
+        return false;
+    } else if (is_symbol(fst(exp)) && form_of(fst(exp)) == form_quote) {
+        return false;
+    } else if (is_symbol(fst(exp)) && binding_form(fst(exp))) {
+        return true;
     } else {
-        return append_defs(cons(fst(def), env), snd(def));
+        for (; !atom(exp); exp = snd(exp)) {
+            if (binds(fst(exp))) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+/*
+ * Bytecode.
+ *
+ * Body of lambda resolved by `resolve` is compiled into instructions of a stack machine
+ * run in the frame of the call. Operand `k` indexes constants of the code object.
+ * Forms the compiler does not know, or malformed ones, are left to the tree walker by OP_EVAL,
+ * so errors are reported at the same time with the same message as the tree walker does.
+ */
+
+enum opcode {
+    OP_CONST,       /* k: push constant k. */
+    OP_LOCAL,       /* k: push value of local variable, constant k. */
+    OP_GLOBAL,      /* k: push value of symbol k found in environment; k + 1 .. k + 3 memoize it. */
+    OP_EVAL,        /* k: push value of expression k evaluated by tree walker. */
+    OP_LAMBDA,      /* k: push closure of (params: code) k capturing current frame. */
+    OP_CONS,        /* replace head and tail with pair. */
+    OP_ATOM,        /* replace value with value of `t` if atom, or nil. */
+    OP_CAR,
+    OP_CDR,
+    OP_NUMBER,      /* check value is number. */
+    OP_ADD,         /* replace x and y with x + y. */
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_LESS,        /* replace x and y with value of `t` if x < y, or nil. */
+    OP_EQUAL,
+    OP_PRIMITIVE,   /* k: if the call next applies built-in k, replace it and its arguments with value, and skip the call. */
+    OP_POP,
+    OP_JUMP,        /* ip: jump to ip. */
+    OP_JUMP_NIL,    /* ip: pop value and jump to ip if it is nil. */
+    OP_CALL,        /* n: replace function and n arguments with value of application. */
+    OP_TAIL_CALL,   /* n: replace current frame with the one of application and run callee. */
+    OP_RETURN,      /* return value of top of stack. */
+};
+
+/* operand stack of code is on C stack, so bodies are compiled only if they fit in. */
+#define VM_STACK 32
+
+struct compiler {
+    unsigned* ops;
+    unsigned length;
+    unsigned capacity;
+    const struct sexp* consts;  /* in reverse order; being on C stack keeps new constants alive. */
+    unsigned size;
+    unsigned depth;             /* operand stack depth at current instruction. */
+    bool ok;
+};
+
+static void compile_exp(struct compiler* c, const struct sexp* exp, bool tail);
+
+static void emit(struct compiler* c, unsigned op) {
+    if (c->length == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 64;
+        c->ops = realloc(c->ops, sizeof(*c->ops) * c->capacity);
+    }
+    c->ops[c->length++] = op;
+}
+
+/* account stack depth changed by an instruction. */
+static void push(struct compiler* c, int n) {
+    c->depth += n;
+    if (c->depth > VM_STACK) {
+        c->ok = false;
+    }
+}
+
+static unsigned constant(struct compiler* c, const struct sexp* exp) {
+    c->consts = cons(exp, c->consts);
+    return c->size++;
+}
+
+static void emit_const(struct compiler* c, unsigned op, const struct sexp* exp) {
+    emit(c, op);
+    emit(c, constant(c, exp));
+    push(c, 1);
+}
+
+/* test whether exp is a proper list of at least n elements. */
+static bool has(const struct sexp* exp, unsigned n) {
+    for (; !atom(exp); exp = snd(exp)) {
+        n -= n > 0;
+    }
+    return n == 0 && nil(exp);
+}
+
+/* test whether cdr of form has at least n elements, which are all the form takes. */
+static bool takes(const struct sexp* form, unsigned n) {
+    const struct sexp* exp = snd(form);
+    for (; n && !atom(exp); exp = snd(exp)) {
+        n -= 1;
+    }
+    return n == 0;
+}
+
+static bool compile_cond(struct compiler* c, const struct sexp* exp, bool tail) {
+    const struct sexp* clauses = snd(exp);
+    const struct sexp* xs;
+    unsigned n = 0;
+    if (!has(clauses, 1)) {
+        return false;
+    }
+    for (xs = clauses; !atom(xs); xs = snd(xs), ++n) {
+        if (atom(fst(xs)) || atom(snd(fst(xs)))) {
+            return false;
+        }
+    }
+
+    unsigned exits[n]; // jumps to the end from each clause.
+    n = 0;
+    for (xs = clauses; !atom(xs); xs = snd(xs)) {
+        compile_exp(c, fst(fst(xs)), false);
+        emit(c, OP_JUMP_NIL);
+        const unsigned next = c->length;
+        emit(c, 0);
+        push(c, -1);
+        compile_exp(c, fst(snd(fst(xs))), tail);
+        push(c, -1);
+        if (!tail) {
+            emit(c, OP_JUMP);
+            exits[n++] = c->length;
+            emit(c, 0);
+        }
+        c->ops[next] = c->length;
+    }
+    emit_const(c, OP_CONST, NIL());
+    if (tail) {
+        emit(c, OP_RETURN);
+    }
+    while (n--) {
+        c->ops[exits[n]] = c->length;
+    }
+    return true;
+}
+
+static bool compile_lambda(struct compiler* c, const struct sexp* exp) {
+    const struct sexp* lambda_cdr = snd(exp);
+    if (atom(lambda_cdr) || (atom(fst(lambda_cdr)) && !nil(fst(lambda_cdr)))) {
+        return false;
+    }
+    const struct sexp* code = compile(snd(lambda_cdr));
+    if (!code) {
+        return false;
+    }
+    emit_const(c, OP_LAMBDA, cons(fst(lambda_cdr), code));
+    return true;
+}
+
+/* compile (op args...) as form_add and others evaluate it: args are proper list, and at least one for `-`. */
+static void compile_arithmetic(struct compiler* c, special_form form, const struct sexp* args) {
+    const unsigned op = form == form_add ? OP_ADD : form == form_subtract ? OP_SUBTRACT : OP_MULTIPLY;
+    if (nil(args)) {
+        emit_const(c, OP_CONST, fixnum(form == form_multiply));
+        return;
+    }
+    if (form == form_subtract && atom(snd(args))) {
+        emit_const(c, OP_CONST, fixnum(0));
+        compile_exp(c, fst(args), false);
+        emit(c, op);
+        push(c, -1);
+        return;
+    }
+    compile_exp(c, fst(args), false);
+    emit(c, OP_NUMBER);
+    for (args = snd(args); !atom(args); args = snd(args)) {
+        compile_exp(c, fst(args), false);
+        emit(c, op);
+        push(c, -1);
+    }
+}
+
+static bool compile_form(struct compiler* c, special_form form, const struct sexp* exp, bool tail) {
+    if (form == form_quote && takes(exp, 1)) {
+        emit_const(c, OP_CONST, fst(snd(exp)));
+    } else if (form == form_cons && takes(exp, 2)) {
+        compile_exp(c, fst(snd(exp)), false);
+        compile_exp(c, fst(snd(snd(exp))), false);
+        emit(c, OP_CONS);
+        push(c, -1);
+    } else if ((form == form_atom || form == form_car || form == form_cdr) && takes(exp, 1)) {
+        compile_exp(c, fst(snd(exp)), false);
+        emit(c, form == form_atom ? OP_ATOM : form == form_car ? OP_CAR : OP_CDR);
+    } else if ((form == form_add || form == form_subtract || form == form_multiply) && has(snd(exp), form == form_subtract)) {
+        compile_arithmetic(c, form, snd(exp));
+    } else if ((form == form_less || form == form_equal) && takes(exp, 2)) {
+        compile_exp(c, fst(snd(exp)), false);
+        compile_exp(c, fst(snd(snd(exp))), false);
+        emit(c, form == form_less ? OP_LESS : OP_EQUAL);
+        push(c, -1);
+    } else if (form == form_cond) {
+        return compile_cond(c, exp, tail);
+    } else if (form != form_lambda || !compile_lambda(c, exp)) {
+        return false;
+    }
+    if (tail) {
+        emit(c, OP_RETURN);
+    }
+    return true;
+}
+
+void compile_exp(struct compiler* c, const struct sexp* exp, bool tail) {
+    if (atom(exp)) {
+        if (nil(exp) || is_fixnum(exp)) {
+            emit_const(c, OP_CONST, exp);
+        } else if (is_local(exp)) {
+            emit_const(c, OP_LOCAL, exp);
+        } else {
+            emit_const(c, OP_GLOBAL, exp);
+            constant(c, NIL()); // captured environment,
+            constant(c, NIL()); // top level environment, and
+            constant(c, NIL()); // value found in them.
+        }
+    } else {
+        const struct sexp* car = fst(exp);
+        special_form form = atom(car) && !nil(car) ? form_of(car) : NULL;
+        if (form) {
+            if (!compile_form(c, form, exp, tail)) {
+                emit_const(c, OP_EVAL, exp);
+            } else {
+                return;
+            }
+        } else if (!has(exp, 1)) {
+            emit_const(c, OP_EVAL, exp); // dotted arguments.
+        } else {
+            unsigned n = 0;
+            const struct sexp* xs;
+            for (xs = exp; !atom(xs); xs = snd(xs), ++n) {
+                compile_exp(c, fst(xs), false);
+            }
+            if (atom(car) && !nil(car) && !is_fixnum(car) && !is_local(car) && primitive_of(car) < NUM_PRIMITIVES) {
+                emit(c, OP_PRIMITIVE);
+                emit(c, primitive_of(car));
+            }
+            emit(c, tail ? OP_TAIL_CALL : OP_CALL);
+            emit(c, n - 1);
+            push(c, 1 - (int) n);
+        }
+    }
+    if (tail) {
+        emit(c, OP_RETURN);
+    }
+}
+
+const struct sexp* compile(const struct sexp* body) {
+    struct compiler c = { .ok = true };
+    const struct sexp* xs;
+    if (atom(body)) {
+        emit_const(&c, OP_CONST, NIL());
+        emit(&c, OP_RETURN);
+    }
+    for (xs = body; !atom(xs); xs = snd(xs)) {
+        if (atom(snd(xs))) {
+            compile_exp(&c, fst(xs), true);
+        } else {
+            compile_exp(&c, fst(xs), false);
+            emit(&c, OP_POP);
+            push(&c, -1);
+        }
+    }
+
+    const struct sexp* code = NULL;
+    if (c.ok) {
+        const struct sexp* consts[c.size];
+        unsigned i = c.size;
+        for (xs = c.consts; i--; xs = snd(xs)) {
+            consts[i] = fst(xs);
+        }
+        code = make_code(body, consts, c.size, c.ops, c.length);
+    }
+    free(c.ops);
+    return code;
+}
+
+/*
+ * Make frame of application of func to n values, or throw TRAP_NOTAPPLICABLE, TRAP_ILLARG as bind does.
+ * Values may be overwritten.
+ */
+static const struct sexp* bind_values(jmp_buf trap, const struct sexp* func, const struct sexp** values, unsigned n,
+                                      const struct sexp* env) {
+    counters.calls += 1;
+    const struct sexp* captured = get_environment(trap, func);
+    const struct sexp* pars = get_params(trap, func);
+    unsigned size = 0;
+    for (; !atom(pars); pars = snd(pars)) {
+        size += 1;
+    }
+    if (n < size || (n > size && nil(pars))) {
+        fprintf(error_stream(), "List length mismatch.");
+        report(": %s", get_params(trap, func));
+        report(" v.s. %s", list_from(n, values, NIL()));
+        longjmp(trap, TRAP_ILLARG);
+    }
+    if (!nil(pars)) {
+        const struct sexp* rest = NIL(); // dotted parameter takes rest.
+        while (n > size) {
+            rest = cons(values[--n], rest);
+        }
+        values[size++] = rest;
+    }
+    return make_frame(get_params(trap, func), values, size, captured, call_site_global(env));
+}
+
+const struct sexp* run(jmp_buf trap, const struct sexp* env, const struct sexp* code, struct print_context* print_context) {
+    const struct sexp* stack[VM_STACK + 1]; // bind_values may put rest of arguments past the top.
+    const struct sexp* const* consts = code_consts(code);
+    const unsigned* ops = code_ops(code);
+    unsigned ip = 0;
+    unsigned sp = 0;
+    while (true) {
+        switch ((enum opcode) ops[ip++]) {
+        case OP_CONST:
+            stack[sp++] = consts[ops[ip++]];
+            break;
+        case OP_LOCAL:
+            stack[sp++] = local_value(env, consts[ops[ip++]]);
+            break;
+        case OP_GLOBAL: {
+            /*
+             * symbol is never a parameter of the frame after `resolve`, so its value depends only on
+             * environments the frame links to, which are immutable.
+             */
+            const struct sexp** memo = (const struct sexp**) consts + ops[ip++];
+            if (memo[1] != frame_captured(env) || memo[2] != frame_global(env) || (nil(memo[1]) && nil(memo[2]))) {
+                if (!gc_owned(code)) { // code of another thread is read only, while called in pmap.
+                    stack[sp++] = find(trap, memo[0], env);
+                    break;
+                }
+                memo[3] = find(trap, memo[0], env);
+                memo[1] = frame_captured(env);
+                memo[2] = frame_global(env);
+            }
+            stack[sp++] = memo[3];
+            break;
+        }
+        case OP_EVAL:
+            stack[sp++] = eval_impl(trap, (struct env_exp){ env, consts[ops[ip++]] }, print_context).exp;
+            break;
+        case OP_LAMBDA: {
+            const struct sexp* lambda = consts[ops[ip++]];
+            stack[sp++] = make_applicable(env, fst(lambda), snd(lambda));
+            break;
+        }
+        case OP_CONS:
+            sp -= 1;
+            stack[sp - 1] = cons(stack[sp - 1], stack[sp]);
+            break;
+        case OP_ATOM:
+            stack[sp - 1] = atom(stack[sp - 1]) ? find(trap, S.t, env) : NIL();
+            break;
+        case OP_CAR:
+            stack[sp - 1] = fst(ensure_pair(trap, stack[sp - 1]));
+            break;
+        case OP_CDR:
+            stack[sp - 1] = snd(ensure_pair(trap, stack[sp - 1]));
+            break;
+        case OP_NUMBER:
+            number(trap, stack[sp - 1]);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY: {
+            const char op = ops[ip - 1] == OP_ADD ? '+' : ops[ip - 1] == OP_SUBTRACT ? '-' : '*';
+            sp -= 1;
+            stack[sp - 1] = arithmetic(trap, op, stack[sp - 1], stack[sp]);
+            break;
+        }
+        case OP_LESS:
+        case OP_EQUAL: {
+            const intptr_t a = number(trap, stack[sp - 2]);
+            const intptr_t b = number(trap, stack[sp - 1]);
+            sp -= 1;
+            stack[sp - 1] = (ops[ip - 1] == OP_LESS ? a < b : a == b) ? find(trap, S.t, env) : NIL();
+            break;
+        }
+        case OP_PRIMITIVE: {
+            const unsigned k = ops[ip++];
+            const unsigned n = ops[ip + 1]; // of OP_CALL or OP_TAIL_CALL, which is followed by OP_RETURN.
+            if (stack[sp - n - 1] == S.builtins[k]) {
+                counters.calls += 1;
+                const struct sexp* value = apply_primitive(trap, primitives + k, stack + sp - n, n, env);
+                sp -= n + 1;
+                stack[sp++] = value;
+                ip += 2;
+            }
+            break;
+        }
+        case OP_POP:
+            sp -= 1;
+            break;
+        case OP_JUMP:
+            ip = ops[ip];
+            break;
+        case OP_JUMP_NIL:
+            ip = nil(stack[--sp]) ? ops[ip] : ip + 1;
+            break;
+        case OP_CALL: {
+            const unsigned n = ops[ip++];
+            sp -= n + 1;
+            const struct sexp* func = stack[sp];
+            const struct sexp* frame = bind_values(trap, func, stack + sp + 1, n, env);
+            const struct sexp* body = get_body(trap, func);
+            if (profile.on) {
+                profile_enter(func);
+            }
+            stack[sp++] = call_body(trap, frame, body, print_context);
+            if (profile.on) {
+                profile_leave();
+            }
+            break;
+        }
+        case OP_TAIL_CALL: {
+            const unsigned n = ops[ip++];
+            const struct sexp* func = stack[sp - n - 1];
+            const struct sexp* body = get_body(trap, func);
+            env = bind_values(trap, func, stack + sp - n, n, env);
+            if (profile.on) {
+                profile_enter(func);
+                profile_replace();
+            }
+            if (!is_code(body)) {
+                return call_body(trap, env, body, print_context);
+            }
+            code = body;
+            consts = code_consts(code);
+            ops = code_ops(code);
+            ip = 0;
+            sp = 0;
+            break;
+        }
+        case OP_RETURN:
+            return stack[sp - 1];
+        }
     }
 }
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+ * Map regular file of fp into memory from its current position.
+ * Return the address of the current position and store the number of remaining bytes into *size,
+ * or return NULL if fp is not a regular file or can not be mapped.
+ * The whole mapping is stored into *base and *length, to be given to funmap.
+ */
+const char* fmap(FILE* fp, size_t* size, const char** base, size_t* length) {
+    struct stat st;
+    const int fd = fileno(fp);
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return NULL;
+    }
+    const off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || offset > st.st_size) {
+        return NULL;
+    }
+    const char* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    madvise((void*) p, st.st_size, MADV_SEQUENTIAL);
+    *base = p;
+    *length = st.st_size;
+    *size = st.st_size - offset;
+    return p + offset;
+}
+
+/* unmap the mapping fmap stored into base and length. */
+void funmap(const char* base, size_t length) {
+    munmap((void*) base, length);
+}
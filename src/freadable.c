@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -12,3 +14,28 @@ bool freadable(FILE* fp) {
 
     return select(fileno(fp) + 1, &fds, NULL, NULL, &timeout);
 }
+
+/* test whether fp is a terminal, where user waits for prompt and response. */
+bool finteractive(FILE* fp) {
+    return isatty(fileno(fp));
+}
+
+/*
+ * Read at most n bytes of fp into buf without waiting more than one read(2) does,
+ * i.e. a line of terminal or what is in a pipe. Return 0 at end of file.
+ * Streams without file descriptor (e.g. fmemopen) are read by fread.
+ */
+size_t freadsome(FILE* fp, char* buf, size_t n) {
+    const int fd = fileno(fp);
+    if (fd < 0) {
+        return fread(buf, 1, n, fp);
+    } else {
+        /* readv, since `read` is the name of lisp reader in this program. */
+        struct iovec iov = { buf, n };
+        ssize_t r;
+        do {
+            r = readv(fd, &iov, 1);
+        } while (r < 0 && errno == EINTR);
+        return r < 0 ? 0 : r;
+    }
+}
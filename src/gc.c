@@ -0,0 +1,739 @@
+#include "ulisp.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* supplied by data.c: call `mark` for each sexp directly referenced by `exp`. */
+extern void trace(const struct sexp* exp, void (*mark)(const struct sexp*));
+/* supplied by data.c: drop symbols which are not marked from the intern table. */
+extern void intern_sweep(bool (*marked)(const struct sexp*));
+
+#define DEFAULT_THRESHOLD (4u << 20)
+
+#define PAGE_SIZE ((size_t) 1 << 16)
+#define PAGE_OF(p) ((struct page*) ((uintptr_t) (p) & ~(PAGE_SIZE - 1)))
+#define GRANULE 8
+#define MAX_TYPES 8
+#define MAX_SMALL 2048 /* larger objects get a page of their own. */
+#define BITMAP_WORDS (PAGE_SIZE / GRANULE / 64)
+#define MAX_SPARE 64
+
+/*
+ * Page of objects of one type and one size (big bag of pages).
+ *
+ * Objects are carved from `bump` up to `limit`; reclaimed ones are chained in `free`.
+ * `used` and `marks` have one bit per object slot; `used` is brought up to date
+ * at the start of each collection so that allocation only bumps or pops.
+ */
+struct page {
+    const void* owner;          /* heap of the thread which allocated the page. */
+    struct page* next;          /* next page of the same class. */
+    struct page* next_free;     /* next page of the same class which has room. */
+    bool mapped;                /* mapped from image file, rather than allocated. */
+    unsigned type;
+    size_t size;                /* object size. */
+    size_t live;                /* number of objects in use. */
+    char* objects;
+    char* bump;
+    char* limit;
+    void* free;
+    uint64_t used[BITMAP_WORDS];
+    uint64_t marks[BITMAP_WORDS];
+};
+
+#define HEADER_SIZE ((sizeof(struct page) + 15) & ~(size_t) 15)
+
+/* pages which hold objects of same type and size. */
+struct class {
+    struct page* pages;
+    struct page* current;       /* page allocating from. */
+    struct page* has_room;      /* pages to allocate from after current. */
+};
+
+/*
+ * Collector state.
+ *
+ * `pages` is an open addressing set of all pages; the conservative stack
+ * scan uses it to tell heap pointers from other words.
+ */
+static _Thread_local struct {
+    struct class classes[MAX_TYPES][MAX_SMALL / GRANULE + 1];
+    struct class large;
+    struct page* spare;     /* empty pages kept for reuse. */
+    size_t num_spare;
+    struct page** pages;
+    size_t capacity;
+    size_t num_pages;
+    size_t objects;         /* number of live objects. */
+    size_t bytes;           /* bytes held by live objects. */
+    size_t allocated;       /* bytes allocated since last collection. */
+    size_t threshold;       /* collection is triggered when `allocated` exceeds this,
+                               or the bytes survived last collection, whichever is larger. */
+    size_t survived;
+    size_t collections;
+    size_t allocations;     /* number of objects allocated ever. */
+    unsigned paused;        /* collection is not triggered by allocation while positive. */
+    const struct sexp*** roots;
+    size_t num_roots;
+    const struct sexp** mark_stack;
+    size_t mark_depth;
+    size_t mark_capacity;
+    char* stack_top;
+} heap; /* of each thread, which scans its own stack. */
+
+static size_t slot_of(const struct page* page, size_t capacity) {
+    return ((uintptr_t) page / PAGE_SIZE) * 2654435761u & (capacity - 1);
+}
+
+static struct page** lookup(struct page** pages, size_t capacity, const struct page* page) {
+    size_t i = slot_of(page, capacity);
+    while (pages[i] && pages[i] != page) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return pages + i;
+}
+
+static void register_page(struct page* page) {
+    if (2 * (heap.num_pages + 1) > heap.capacity) {
+        const size_t capacity = heap.capacity ? heap.capacity * 2 : 64;
+        struct page** pages = calloc(capacity, sizeof(struct page*));
+        size_t i;
+        for (i = 0; i < heap.capacity; ++i) {
+            if (heap.pages[i]) {
+                *lookup(pages, capacity, heap.pages[i]) = heap.pages[i];
+            }
+        }
+        free(heap.pages);
+        heap.pages = pages;
+        heap.capacity = capacity;
+    }
+    *lookup(heap.pages, heap.capacity, page) = page;
+    heap.num_pages += 1;
+}
+
+static void unregister_page(struct page* page) {
+    size_t i = lookup(heap.pages, heap.capacity, page) - heap.pages;
+    heap.pages[i] = NULL;
+    heap.num_pages -= 1;
+    /* re-insert followers in the probe sequence. */
+    for (i = (i + 1) & (heap.capacity - 1); heap.pages[i]; i = (i + 1) & (heap.capacity - 1)) {
+        struct page* moved = heap.pages[i];
+        heap.pages[i] = NULL;
+        *lookup(heap.pages, heap.capacity, moved) = moved;
+    }
+}
+
+static size_t index_of(const struct page* page, const void* p) {
+    return ((const char*) p - page->objects) / page->size;
+}
+
+static bool test_bit(const uint64_t* bitmap, size_t i) {
+    return bitmap[i / 64] & (uint64_t) 1 << i % 64;
+}
+
+/* return start of the object `p` points into, or NULL if `p` is not a heap pointer. */
+static const struct sexp* object_of(const void* p) {
+    if (heap.capacity) {
+        const struct page* page = *lookup(heap.pages, heap.capacity, PAGE_OF(p));
+        if (page && (const char*) p >= page->objects && (const char*) p < page->bump) {
+            const size_t i = index_of(page, p);
+            if (test_bit(page->used, i)) {
+                return (const void*) (page->objects + i * page->size);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* bytes taken by page of objects of size, which is a multiple of PAGE_SIZE. */
+static size_t page_bytes(size_t size) {
+    return size > MAX_SMALL ? (HEADER_SIZE + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1) : PAGE_SIZE;
+}
+
+static void free_page(struct page* page) {
+    if (page->mapped) {
+        munmap(page, page_bytes(page->size));
+    } else {
+        free(page);
+    }
+}
+
+static struct page* new_page(unsigned type, size_t size) {
+    const size_t bytes = page_bytes(size);
+    struct page* page;
+    if (bytes == PAGE_SIZE && heap.spare) {
+        page = heap.spare;
+        heap.spare = page->next;
+        heap.num_spare -= 1;
+    } else {
+        page = aligned_alloc(PAGE_SIZE, bytes);
+    }
+    memset(page, 0, sizeof(struct page));
+    page->owner = &heap;
+    page->type = type;
+    page->size = size;
+    page->objects = (char*) page + HEADER_SIZE;
+    page->bump = page->objects;
+    page->limit = page->objects + (bytes - HEADER_SIZE) / size * size;
+    register_page(page);
+    return page;
+}
+
+static void init() {
+    if (!heap.stack_top) {
+        pthread_attr_t attr;
+        void* addr;
+        size_t size;
+        pthread_getattr_np(pthread_self(), &attr);
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        heap.stack_top = (char*) addr + size;
+
+        const char* threshold = getenv("ULISP_GC_THRESHOLD");
+        heap.threshold = threshold ? strtoul(threshold, NULL, 0) : DEFAULT_THRESHOLD;
+    }
+}
+
+static void* alloc_from(struct page* page) {
+    void* p;
+    if (page->free) {
+        p = page->free;
+        page->free = *(void**) p;
+    } else if (page->bump < page->limit) {
+        p = page->bump;
+        page->bump += page->size;
+    } else {
+        return NULL;
+    }
+    page->live += 1;
+    return p;
+}
+
+/* set up the heap if not yet, and collect if allocated enough since the last collection; before each allocation. */
+static void prepare_alloc() {
+    init();
+    if (heap.allocated > heap.threshold && heap.allocated > heap.survived && !heap.paused) {
+        collect_garbage();
+    }
+}
+
+/* allocate an object of type and size, already rounded up to GRANULE, once prepare_alloc is done. */
+static void* alloc(unsigned type, size_t size) {
+    heap.objects += 1;
+    heap.bytes += size;
+    heap.allocated += size;
+    heap.allocations += 1;
+
+    if (size > MAX_SMALL) {
+        struct page* page = new_page(type, size);
+        page->next = heap.large.pages;
+        heap.large.pages = page;
+        return alloc_from(page);
+    }
+
+    struct class* class = &heap.classes[type][size / GRANULE];
+    void* p = class->current ? alloc_from(class->current) : NULL;
+    while (!p) {
+        if (class->has_room) {
+            class->current = class->has_room;
+            class->has_room = class->has_room->next_free;
+        } else {
+            class->current = new_page(type, size);
+            class->current->next = class->pages;
+            class->pages = class->current;
+        }
+        p = alloc_from(class->current);
+    }
+    return p;
+}
+
+void* gc_alloc(unsigned type, size_t size) {
+    size = (size + GRANULE - 1) & ~(size_t) (GRANULE - 1);
+    prepare_alloc();
+    return alloc(type, size);
+}
+
+/*
+ * Allocate objects of type and size, up to n of them laid out in turn from *run, and return how many.
+ * Those are bumped from one page at once, so their memory must be initialized before the next allocation.
+ */
+size_t gc_alloc_run(unsigned type, size_t size, size_t n, void** run) {
+    size = (size + GRANULE - 1) & ~(size_t) (GRANULE - 1);
+    prepare_alloc();
+    struct class* class = &heap.classes[type][size / GRANULE];
+    if (size > MAX_SMALL || !class->current || class->current->bump >= class->current->limit) {
+        *run = alloc(type, size); // takes a page to bump from, unless it reused a free slot.
+        return 1;
+    }
+    struct page* page = class->current;
+    const size_t room = (page->limit - page->bump) / size;
+    n = n < room ? n : room;
+    *run = page->bump;
+    page->bump += n * size;
+    page->live += n;
+    heap.objects += n;
+    heap.bytes += n * size;
+    heap.allocated += n * size;
+    heap.allocations += n;
+    return n;
+}
+
+unsigned gc_type(const struct sexp* exp) {
+    return PAGE_OF(exp)->type;
+}
+
+/* size of object exp, as rounded up by allocation. */
+size_t gc_size(const struct sexp* exp) {
+    return PAGE_OF(exp)->size;
+}
+
+/* test whether object exp is allocated by this thread, rather than by interpreter of another one. */
+bool gc_owned(const struct sexp* exp) {
+    return PAGE_OF(exp)->owner == &heap;
+}
+
+/* hold (if true) or let (if false) collection by allocation, e.g. while objects are referred only from malloc'ed memory. nestable. */
+void gc_pause(bool pause) {
+    heap.paused += pause ? 1 : -1;
+}
+
+size_t gc_bytes_per_object(size_t size) {
+    size = (size + GRANULE - 1) & ~(size_t) (GRANULE - 1);
+    return PAGE_SIZE / ((PAGE_SIZE - HEADER_SIZE) / size);
+}
+
+void gc_root(const struct sexp** slot) {
+    heap.roots = realloc(heap.roots, sizeof(*heap.roots) * (heap.num_roots + 1));
+    heap.roots[heap.num_roots++] = slot;
+}
+
+/* objects of other threads, which may be referred while running their jobs, are left to them. */
+static void mark(const struct sexp* exp) {
+    if (exp && !is_fixnum(exp)) {
+        struct page* page = PAGE_OF(exp);
+        const size_t i = index_of(page, exp);
+        if (page->owner == &heap && !test_bit(page->marks, i)) {
+            page->marks[i / 64] |= (uint64_t) 1 << i % 64;
+            if (heap.mark_depth == heap.mark_capacity) {
+                heap.mark_capacity = heap.mark_capacity ? heap.mark_capacity * 2 : 256;
+                heap.mark_stack = realloc(heap.mark_stack, sizeof(*heap.mark_stack) * heap.mark_capacity);
+            }
+            heap.mark_stack[heap.mark_depth++] = exp;
+        }
+    }
+}
+
+static bool marked(const struct sexp* exp) {
+    const struct page* page = PAGE_OF(exp);
+    return test_bit(page->marks, index_of(page, exp));
+}
+
+/* treat every word on the C stack above the frame of this function which looks like an object as root. */
+static void __attribute__((noinline)) mark_stack() {
+    const void* const* p = (const void* const*) __builtin_frame_address(0);
+    for (; (char*) p < heap.stack_top; ++p) {
+        mark(object_of(*p));
+    }
+}
+
+/*
+ * spill callee saved registers into the frame of this function, which mark_stack scans as it is called from here.
+ * jmp_buf does not do for this, as glibc mangles the frame and stack pointers saved in it.
+ */
+static void __attribute__((noinline)) scan_stack() {
+    __builtin_unwind_init();
+    mark_stack();
+    __asm__ volatile("" ::: "memory"); /* keep the frame until mark_stack returns, i.e. no tail call. */
+}
+
+/* set used bits of objects allocated since last collection. */
+static void prepare_page(struct page* page) {
+    const size_t n = index_of(page, page->bump);
+    const void* p;
+    memset(page->used, 0xff, n / 64 * sizeof(uint64_t));
+    if (n % 64) {
+        page->used[n / 64] = ((uint64_t) 1 << n % 64) - 1;
+    }
+    for (p = page->free; p; p = *(void* const*) p) {
+        const size_t i = index_of(page, p);
+        page->used[i / 64] &= ~((uint64_t) 1 << i % 64);
+    }
+}
+
+static void prepare_class(struct class* class) {
+    struct page* page;
+    for (page = class->pages; page; page = page->next) {
+        prepare_page(page);
+    }
+}
+
+/* chain unmarked objects of page into its free list. return true if page got empty. */
+static bool sweep_page(struct page* page) {
+    const size_t n = index_of(page, page->bump);
+    size_t i;
+    page->free = NULL;
+    for (i = n; i--; ) {
+        if (test_bit(page->used, i) && !test_bit(page->marks, i)) {
+            page->used[i / 64] &= ~((uint64_t) 1 << i % 64);
+            page->live -= 1;
+            heap.objects -= 1;
+            heap.bytes -= page->size;
+        }
+        if (!test_bit(page->used, i)) {
+            void* p = page->objects + i * page->size;
+            *(void**) p = page->free;
+            page->free = p;
+        }
+    }
+    memset(page->marks, 0, sizeof(page->marks));
+    return page->live == 0;
+}
+
+static void sweep_class(struct class* class) {
+    struct page** link = &class->pages;
+    class->current = NULL;
+    class->has_room = NULL;
+    while (*link) {
+        struct page* page = *link;
+        if (sweep_page(page)) {
+            *link = page->next;
+            unregister_page(page);
+            if (page->size <= MAX_SMALL && heap.num_spare < MAX_SPARE && !page->mapped) {
+                page->next = heap.spare;
+                heap.spare = page;
+                heap.num_spare += 1;
+            } else {
+                free_page(page);
+            }
+        } else {
+            if (page->free || page->bump < page->limit) {
+                page->next_free = class->has_room;
+                class->has_room = page;
+            }
+            link = &page->next;
+        }
+    }
+}
+
+void collect_garbage() {
+    size_t i, j;
+    init();
+
+    for (i = 0; i < MAX_TYPES; ++i) {
+        for (j = 0; j <= MAX_SMALL / GRANULE; ++j) {
+            prepare_class(&heap.classes[i][j]);
+        }
+    }
+    prepare_class(&heap.large);
+
+    scan_stack();
+    for (i = 0; i < heap.num_roots; ++i) {
+        mark(*heap.roots[i]);
+    }
+    while (heap.mark_depth) {
+        trace(heap.mark_stack[--heap.mark_depth], mark);
+    }
+
+    intern_sweep(marked);
+
+    for (i = 0; i < MAX_TYPES; ++i) {
+        for (j = 0; j <= MAX_SMALL / GRANULE; ++j) {
+            sweep_class(&heap.classes[i][j]);
+        }
+    }
+    sweep_class(&heap.large);
+
+    heap.allocated = 0;
+    heap.survived = heap.bytes;
+    heap.collections += 1;
+}
+
+static void free_pages(struct page* page) {
+    while (page) {
+        struct page* next = page->next;
+        free_page(page);
+        page = next;
+    }
+}
+
+/* free all pages and tables of heap; it is initialized again by next allocation. */
+void gc_release() {
+    size_t i, j;
+    for (i = 0; i < MAX_TYPES; ++i) {
+        for (j = 0; j <= MAX_SMALL / GRANULE; ++j) {
+            free_pages(heap.classes[i][j].pages);
+        }
+    }
+    free_pages(heap.large.pages);
+    free_pages(heap.spare);
+    free(heap.pages);
+    free(heap.roots);
+    free(heap.mark_stack);
+    memset(&heap, 0, sizeof(heap));
+}
+
+/*
+ * Heap image: pages of objects written as they are laid out in memory, so that they are
+ * mapped back into heap as pages without parsing.
+ *
+ * A header block is followed by blocks of pages, which are addressed from `base`.
+ * Mapped at `base`, references in the image are valid as they are; otherwise they are
+ * relocated by the difference. Objects are packed into new pages in the order written.
+ */
+#define IMAGE_MAGIC "ulispimg"
+#define IMAGE_VERSION 1
+#define IMAGE_BASE ((uintptr_t) 0x200000000000) /* far from heap and stack, where mapping likely succeeds. */
+
+struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t base;      /* address of the first page block, where references need no relocation. */
+    uint64_t blocks;    /* number of PAGE_SIZE blocks of pages following the header block. */
+    uint64_t root;
+};
+
+/*
+ * Image being written: `pages` in order of address, the page each class is filling,
+ * and `from` / `to` an open addressing table of objects written and their addresses in image.
+ */
+struct image {
+    struct image_page {
+        char* data;
+        size_t block;
+        unsigned type;
+        size_t size;
+        size_t count;
+    } * pages;
+    size_t num_pages;
+    size_t pages_capacity;
+    size_t blocks;
+    size_t current[MAX_TYPES][MAX_SMALL / GRANULE + 1]; /* page number + 1, or 0. */
+    const void** from;
+    uintptr_t* to;
+    size_t capacity;
+    size_t count;
+};
+
+struct image* image_new() {
+    return calloc(1, sizeof(struct image));
+}
+
+static size_t image_slot(const struct image* image, const void* object) {
+    size_t i = ((uintptr_t) object >> 3) * 2654435761u & (image->capacity - 1);
+    while (image->from[i] && image->from[i] != object) {
+        i = (i + 1) & (image->capacity - 1);
+    }
+    return i;
+}
+
+static void image_insert(struct image* image, const void* object, uintptr_t address) {
+    if (2 * (image->count + 1) > image->capacity) {
+        const struct image old = *image;
+        size_t i;
+        image->capacity = old.capacity ? old.capacity * 2 : 1024;
+        image->from = calloc(image->capacity, sizeof(*image->from));
+        image->to = calloc(image->capacity, sizeof(*image->to));
+        for (i = 0; i < old.capacity; ++i) {
+            if (old.from[i]) {
+                const size_t j = image_slot(image, old.from[i]);
+                image->from[j] = old.from[i];
+                image->to[j] = old.to[i];
+            }
+        }
+        free(old.from);
+        free(old.to);
+    }
+    const size_t i = image_slot(image, object);
+    image->from[i] = object;
+    image->to[i] = address;
+    image->count += 1;
+}
+
+static struct image_page* image_page(struct image* image, unsigned type, size_t size) {
+    if (image->num_pages == image->pages_capacity) {
+        image->pages_capacity = image->pages_capacity ? image->pages_capacity * 2 : 16;
+        image->pages = realloc(image->pages, sizeof(*image->pages) * image->pages_capacity);
+    }
+    const size_t bytes = page_bytes(size);
+    struct image_page* page = image->pages + image->num_pages++;
+    *page = (struct image_page){ .data = calloc(1, bytes), .block = image->blocks, .type = type, .size = size };
+    image->blocks += bytes / PAGE_SIZE;
+    return page;
+}
+
+/*
+ * Address in image of object exp of this heap, which may be tagged; nil and fixnum are as they are.
+ * If exp is not written yet, its bytes are copied into image and *copy is set to the copy,
+ * whose references are to be replaced by their addresses in image; otherwise *copy is set to NULL.
+ */
+const struct sexp* image_place(struct image* image, const struct sexp* exp, void** copy, unsigned* type) {
+    *copy = NULL;
+    if (!exp || is_fixnum(exp)) {
+        return exp;
+    }
+    const struct page* page = PAGE_OF(exp);
+    const char* object = page->objects + index_of(page, exp) * page->size;
+    const uintptr_t tag = (const char*) exp - object;
+    if (image->capacity) {
+        const size_t i = image_slot(image, object);
+        if (image->from[i]) {
+            return (const void*) (image->to[i] + tag);
+        }
+    }
+    struct image_page* target;
+    if (page->size > MAX_SMALL) {
+        target = image_page(image, page->type, page->size);
+    } else {
+        size_t* current = &image->current[page->type][page->size / GRANULE];
+        if (!*current || HEADER_SIZE + (image->pages[*current - 1].count + 1) * page->size > PAGE_SIZE) {
+            image_page(image, page->type, page->size);
+            *current = image->num_pages;
+        }
+        target = image->pages + *current - 1;
+    }
+    const size_t offset = HEADER_SIZE + target->count++ * page->size;
+    const uintptr_t address = IMAGE_BASE + target->block * PAGE_SIZE + offset;
+    memcpy(target->data + offset, object, page->size);
+    image_insert(image, object, address);
+    *copy = target->data + offset;
+    *type = page->type;
+    return (const void*) (address + tag);
+}
+
+/* write image with root as its root object into file at path, and free image. return false if it can not be written. */
+bool image_write(struct image* image, const char* path, const struct sexp* root) {
+    FILE* fp = fopen(path, "wb");
+    size_t i;
+    bool ok = fp != NULL;
+    if (ok) {
+        char* block = calloc(1, PAGE_SIZE);
+        struct image_header header = {
+            .version = IMAGE_VERSION, .page_size = PAGE_SIZE, .base = IMAGE_BASE, .blocks = image->blocks, .root = (uintptr_t) root,
+        };
+        memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+        memcpy(block, &header, sizeof(header));
+        ok = fwrite(block, PAGE_SIZE, 1, fp) == 1;
+        free(block);
+    }
+    for (i = 0; i < image->num_pages; ++i) {
+        struct image_page* source = image->pages + i;
+        struct page* page = (void*) source->data;
+        char* const address = (char*) (IMAGE_BASE + source->block * PAGE_SIZE);
+        page->type = source->type;
+        page->size = source->size;
+        page->live = source->count;
+        page->objects = address + HEADER_SIZE;
+        page->bump = page->objects + source->count * source->size;
+        page->limit = page->objects + (page_bytes(source->size) - HEADER_SIZE) / source->size * source->size;
+        ok = ok && fwrite(source->data, page_bytes(source->size), 1, fp) == 1;
+        free(source->data);
+    }
+    if (fp) {
+        ok = !fclose(fp) && ok;
+    }
+    free(image->pages);
+    free(image->from);
+    free(image->to);
+    free(image);
+    return ok;
+}
+
+/*
+ * Map image file at path into heap, and store its root into *root and the difference of addresses
+ * from where the image was written into *delta; the root and references in the image are left to be relocated by it.
+ * Pages mapped are stored into *start and *bytes. Only their headers are written, to put them into heap.
+ * Return false if it is not an image.
+ */
+bool gc_map_image(const char* path, const struct sexp** root, intptr_t* delta, char** start, size_t* bytes) {
+    struct image_header header;
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic))
+        || header.version != IMAGE_VERSION || header.page_size != PAGE_SIZE) {
+        fclose(fp);
+        return false;
+    }
+    init();
+    const size_t size = header.blocks * PAGE_SIZE;
+    char* at = MAP_FAILED;
+    if (size) {
+        at = mmap((void*) header.base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED_NOREPLACE, fileno(fp), PAGE_SIZE);
+        if (at != MAP_FAILED && at != (char*) header.base) {
+            munmap(at, size); // kernel without MAP_FIXED_NOREPLACE took it as a hint.
+            at = MAP_FAILED;
+        }
+        if (at == MAP_FAILED) {
+            /* map at an address aligned to PAGE_SIZE in a reserved range, and return the rest. */
+            char* const reserved = mmap(NULL, size + PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (reserved != MAP_FAILED) {
+                char* const aligned = (char*) (((uintptr_t) reserved + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+                at = mmap(aligned, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(fp), PAGE_SIZE);
+                if (aligned > reserved) {
+                    munmap(reserved, aligned - reserved);
+                }
+                munmap(aligned + size, reserved + PAGE_SIZE - aligned);
+            }
+        }
+    }
+    fclose(fp);
+    if (size && at == MAP_FAILED) {
+        return false;
+    }
+    *delta = size ? (intptr_t) (at - (char*) header.base) : 0;
+    *start = size ? at : NULL;
+    *bytes = size;
+    *root = (const void*) (uintptr_t) header.root;
+
+    char* p;
+    for (p = at; size && p < at + size; p += page_bytes(((struct page*) p)->size)) {
+        struct page* page = (void*) p;
+        page->owner = &heap;
+        page->mapped = true;
+        page->next_free = NULL;
+        page->free = NULL;
+        page->objects += *delta;
+        page->bump += *delta;
+        page->limit += *delta;
+        struct class* class = page->size > MAX_SMALL ? &heap.large : &heap.classes[page->type][page->size / GRANULE];
+        page->next = class->pages;
+        class->pages = page;
+        if (page->bump < page->limit && page->size <= MAX_SMALL) {
+            page->next_free = class->has_room;
+            class->has_room = page;
+        }
+        register_page(page);
+        heap.objects += page->live;
+        heap.bytes += page->live * page->size;
+    }
+    return true;
+}
+
+/* call f with each object of type (or of all types if type is -1) in pages mapped by gc_map_image. */
+void gc_image_objects(char* start, size_t bytes, unsigned type, void (*f)(struct sexp* exp, void* arg), void* arg) {
+    char* p;
+    for (p = start; p < start + bytes; p += page_bytes(((struct page*) p)->size)) {
+        struct page* page = (void*) p;
+        char* object;
+        if (type == (unsigned) -1 || page->type == type) {
+            for (object = page->objects; object < page->bump; object += page->size) {
+                f((void*) object, arg);
+            }
+        }
+    }
+}
+
+void set_gc_threshold(size_t bytes) {
+    init();
+    heap.threshold = bytes;
+}
+
+struct gc_stats gc_stats() {
+    return (struct gc_stats){ .objects = heap.objects, .bytes = heap.bytes, .collections = heap.collections,
+                              .allocations = heap.allocations };
+}
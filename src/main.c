@@ -2,26 +2,102 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <setjmp.h>
 
 extern bool freadable(FILE* fp);
+extern bool finteractive(FILE* fp);
 
-int main() {
+/* evaluate expressions in fp, writing each value into stdout and keeping definitions in *env; return the trap code which stopped it. */
+static int batch_file(const struct sexp** env, FILE* fp) {
+    struct source* source = open_source(fp);
     jmp_buf trap;
-    const struct sexp* True = cons(symbol("t"), symbol("True"));
-    struct env_exp r = { .env = cons(True, NIL()), };
+    const int code = setjmp(trap);
+    if (code == TRAP_NONE) {
+        while (true) {
+            const struct env_exp r = eval(trap, (struct env_exp){ *env, read_source(trap, source) });
+            *env = r.env;
+            write_value(stdout, r.env, r.exp);
+            putchar('\n');
+        }
+    }
+    close_source(source);
+    return code;
+}
+
+/*
+ * Evaluate expressions in files in turn, writing each value into stdout.
+ * Stop at the first error, and return its trap code; or TRAP_NONE if all are evaluated.
+ * "-" reads stdin.
+ */
+static int batch(const struct sexp* initial, char* paths[], int n) {
+    static char buffer[1 << 16];
+    const struct sexp* env = initial;
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    for (; n--; ++paths) {
+        FILE* fp = strcmp("-", *paths) ? fopen(*paths, "r") : stdin;
+        if (!fp) {
+            fprintf(error_stream(), "Cannot open file: %s\n", *paths);
+            return TRAP_NOFILE;
+        }
+        const int code = batch_file(&env, fp);
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        if (code != TRAP_NOINPUT) {
+            fprintf(stderr, "\n");
+            return code;
+        }
+    }
+    return TRAP_NONE;
+}
+
+static void report_profile() {
+    profile_report(stderr);
+}
+
+int main(int argc, char* argv[]) {
+    jmp_buf trap;
+    struct env_exp r = { 0 };
+    const bool interactive = finteractive(stdin);
+
+    atexit(report_profile);
+    for (; argc > 1 && argv[1][0] == '-' && argv[1][1]; argv += 1, argc -= 1) {
+        if (!strcmp("-p", argv[1])) {
+            set_profiling(true);
+        } else if (!strcmp("--image", argv[1]) && argc > 2 && !r.env) {
+            // before any symbol is interned, so that the image is mapped as it is.
+            if (!load_image(argv[2], &r.env)) {
+                fprintf(stderr, "Cannot load image: %s\n", argv[2]);
+                return TRAP_NOFILE;
+            }
+            argv += 1;
+            argc -= 1;
+        } else {
+            break;
+        }
+    }
+    if (!r.env) {
+        r.env = cons(cons(symbol("t"), symbol("True")), NIL());
+    }
+
+    if (argc > 1) {
+        return batch(r.env, argv + 1, argc - 1);
+    }
 
     switch (setjmp(trap)) {
     default:
         fprintf(stderr, "\n");
     case TRAP_NONE:
         while (true) {
-            if (!freadable(stdin)) {
-                printf("> ");
+            if (interactive) {
+                if (!freadable(stdin)) {
+                    printf("> ");
+                }
+                fflush(stdout);
             }
-            fflush(stdout);
             r = eval(trap, (struct env_exp){ r.env, read(trap) });
-            write(stdout, r.exp);
+            write_value(stdout, r.env, r.exp);
             printf("\n");
         }
         break;
@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+
+#define MAX_WORKERS 64
+
+/*
+ * Pool of worker threads running chunks of jobs, shared by all threads.
+ *
+ * Each worker attached to a job owns a range of chunk numbers, taking chunks from its front.
+ * A worker whose range got empty steals the back half of the largest range of the job,
+ * so chunks are claimed in order and work moves only when a worker runs out of it.
+ * A worker stays attached until the job is released, so that what it made for the job
+ * is left untouched until the calling thread has collected it.
+ */
+struct job {
+    struct job* next;
+    size_t chunks;
+    void* arg;
+    void (*enter)(void* arg);
+    bool (*run)(void* arg, size_t chunk);
+    void (*leave)(void* arg);
+    struct range {
+        size_t begin;
+        size_t end;
+    } ranges[MAX_WORKERS];
+    unsigned attached;  /* workers ever attached, i.e. number of ranges. */
+    unsigned active;    /* workers attached now. */
+    size_t left;        /* chunks not finished yet. */
+    size_t failed;      /* first chunk failed, or `chunks`; chunks after it are skipped. */
+    bool released;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* workers wait for jobs and release. */
+    pthread_cond_t done;    /* calling threads wait for progress of jobs. */
+    pthread_once_t once;
+    struct job* jobs;       /* jobs which have chunks nobody claimed, oldest first. */
+    unsigned size;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_ONCE_INIT };
+
+static _Thread_local bool worker;
+
+/* number of chunks of job nobody claimed. */
+static size_t unclaimed(const struct job* job) {
+    size_t n = job->attached ? 0 : job->chunks;
+    unsigned i;
+    for (i = 0; i < job->attached; ++i) {
+        n += job->ranges[i].end - job->ranges[i].begin;
+    }
+    return n;
+}
+
+static void unlink_job(struct job* job) {
+    struct job** link = &pool.jobs;
+    while (*link && *link != job) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = job->next;
+    }
+}
+
+/* claim next chunk for i-th worker of job into *chunk, stealing if its range is empty. return false if none is left. */
+static bool claim(struct job* job, unsigned i, size_t* chunk) {
+    struct range* own = job->ranges + i;
+    if (own->begin == own->end) {
+        struct range* victim = NULL;
+        unsigned j;
+        for (j = 0; j < job->attached; ++j) {
+            const struct range* r = job->ranges + j;
+            if (!victim || r->end - r->begin > victim->end - victim->begin) {
+                victim = job->ranges + j;
+            }
+        }
+        if (victim->begin == victim->end) {
+            return false;
+        }
+        own->end = victim->end;
+        own->begin = victim->end - (victim->end - victim->begin + 1) / 2;
+        victim->end = own->begin;
+    }
+    *chunk = own->begin++;
+    return true;
+}
+
+static void* work(void* unused) {
+    worker = true;
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        struct job* job;
+        for (job = pool.jobs; job && !unclaimed(job); job = pool.jobs) {
+            unlink_job(job);
+        }
+        if (!job) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+            continue;
+        }
+        const unsigned i = job->attached++;
+        job->active += 1;
+        job->ranges[i] = i ? (struct range){ 0, 0 } : (struct range){ 0, job->chunks };
+        if (job->attached == MAX_WORKERS) {
+            unlink_job(job);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        job->enter(job->arg);
+        pthread_mutex_lock(&pool.lock);
+
+        size_t chunk;
+        while (claim(job, i, &chunk)) {
+            if (chunk < job->failed) {
+                pthread_mutex_unlock(&pool.lock);
+                const bool ok = job->run(job->arg, chunk);
+                pthread_mutex_lock(&pool.lock);
+                if (!ok && chunk < job->failed) {
+                    job->failed = chunk;
+                }
+            }
+            if (--job->left == 0) {
+                pthread_cond_broadcast(&pool.done);
+            }
+        }
+        while (!job->released) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        job->leave(job->arg);
+        pthread_mutex_lock(&pool.lock);
+        if (--job->active == 0) {
+            pthread_cond_broadcast(&pool.done);
+        }
+    }
+    return NULL;
+}
+
+static void start() {
+    const char* threads = getenv("ULISP_THREADS");
+    unsigned size = threads ? strtoul(threads, NULL, 0) : (unsigned) get_nprocs();
+    size = size < 1 ? 1 : size > MAX_WORKERS ? MAX_WORKERS : size;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (; pool.size < size; ++pool.size) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, work, NULL)) {
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* number of worker threads, which are started by the first call. */
+unsigned pool_size() {
+    pthread_once(&pool.once, start);
+    return pool.size;
+}
+
+/* test whether calling thread is a worker of pool. */
+bool pool_worker() {
+    return worker;
+}
+
+/*
+ * Run chunks 0 .. chunks - 1 of a job on workers, and return the first chunk failed, or `chunks`.
+ *
+ * Each worker calls `enter` before its first chunk and `leave` after the job is done: all chunks are
+ * run and `collect` is called by the calling thread, unless a chunk failed. `run` returns false
+ * if the chunk failed; chunks after a failed one may be skipped, but those before it are all run.
+ * Must not be called from a worker (see `pool_worker`), which would wait for itself.
+ */
+size_t pool_run(size_t chunks, void* arg, void (*enter)(void* arg), bool (*run)(void* arg, size_t chunk),
+                void (*collect)(void* arg), void (*leave)(void* arg)) {
+    struct job job = {
+        .chunks = chunks, .arg = arg, .enter = enter, .run = run, .leave = leave, .left = chunks, .failed = chunks,
+    };
+    pool_size();
+    pthread_mutex_lock(&pool.lock);
+    struct job** link = &pool.jobs;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = &job;
+    pthread_cond_broadcast(&pool.wake);
+    while (job.left) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    unlink_job(&job);
+    pthread_mutex_unlock(&pool.lock);
+
+    if (job.failed == chunks) {
+        collect(arg);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    job.released = true;
+    pthread_cond_broadcast(&pool.wake);
+    while (job.active) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return job.failed;
+}
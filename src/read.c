@@ -1,5 +1,6 @@
 #include "ulisp.h"
 
+#include <errno.h>
 #include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,128 +9,270 @@
 
 #define STR_EQ(a, b) (!strcmp((a), (b)))
 
-static const struct sexp* read_aux(jmp_buf trap, char* token);
-static const struct sexp* read_cdr(jmp_buf trap);
+extern const char* fmap(FILE* fp, size_t* size, const char** base, size_t* length);
+extern void funmap(const char* base, size_t length);
+extern size_t freadsome(FILE* fp, char* buf, size_t n);
+extern FILE* error_stream();
 
-static char* fgettoken(jmp_buf trap, FILE* fp);
-static void fgettok_normal(jmp_buf trap, FILE* fin, FILE* fout, bool trailing);
-static void fgettok_escape(jmp_buf trap, FILE* fin, FILE* fout);
-static void fgettok_begin(jmp_buf trap, FILE* fin, FILE* fout) { return fgettok_normal(trap, fin, fout, false); }
-static void fgettok_trail(jmp_buf trap, FILE* fin, FILE* fout) { return fgettok_normal(trap, fin, fout, true); }
+/*
+ * Input scanned in place: characters in [p, end) are not scanned yet.
+ *
+ * Whole input is in memory if the source is a string or a mapped file,
+ * otherwise `buffer` is refilled from `fp` as scanning reaches its end.
+ * Tokens are built into `token`, which is reused by the next one.
+ */
+struct source {
+    const char* p;
+    const char* end;
+    FILE* fp;
+    char* buffer;
+    const char* map; // whole mapping of the file, of which [p, end) is the unread part.
+    size_t map_length;
+    char* token;
+    size_t token_capacity;
+};
+
+#define BUFFER_SIZE 65536
+
+static const struct sexp* read_aux(jmp_buf trap, struct source* source, const char* token);
+static const struct sexp* read_cdr(jmp_buf trap, struct source* source);
+static const struct sexp* atom_of(jmp_buf trap, const char* token);
+
+static const char* gettoken(jmp_buf trap, struct source* source);
+
+/* source read by `read`, reopened when stdin is replaced. */
+static _Thread_local struct {
+    FILE* fp;
+    struct source* source;
+} input;
+
+static struct source* new_source(const char* p, size_t n) {
+    struct source* source = calloc(1, sizeof(struct source));
+    source->p = p;
+    source->end = p + n;
+    source->token_capacity = 64;
+    source->token = malloc(source->token_capacity);
+    return source;
+}
+
+struct source* open_source(FILE* fp) {
+    size_t size;
+    const char* base;
+    size_t length;
+    const char* map = fmap(fp, &size, &base, &length);
+    if (map) {
+        struct source* source = new_source(map, size);
+        source->map = base;
+        source->map_length = length;
+        return source;
+    } else {
+        struct source* source = new_source(NULL, 0);
+        source->fp = fp;
+        source->buffer = malloc(BUFFER_SIZE);
+        source->p = source->end = source->buffer;
+        return source;
+    }
+}
+
+struct source* string_source(const char* p, size_t n) {
+    return new_source(p, n);
+}
+
+void close_source(struct source* source) {
+    if (source->map) {
+        funmap(source->map, source->map_length);
+    }
+    free(source->buffer);
+    free(source->token);
+    free(source);
+}
+
+/* close source of `read`. */
+void read_release() {
+    if (input.source) {
+        close_source(input.source);
+    }
+    input.source = NULL;
+    input.fp = NULL;
+}
 
 const struct sexp* read(jmp_buf trap) {
-    char* token = fgettoken(trap, stdin);
+    if (input.fp != stdin) {
+        if (input.source) {
+            close_source(input.source);
+        }
+        input.source = open_source(stdin);
+        input.fp = stdin;
+    }
+    return read_source(trap, input.source);
+}
+
+const struct sexp* read_source(jmp_buf trap, struct source* source) {
+    const char* token = gettoken(trap, source);
     if (STR_EQ("", token)) {
-        free(token);
         longjmp(trap, TRAP_NOINPUT);
     }
-    return read_aux(trap, token);
+    return read_aux(trap, source, token);
 }
 
-static const struct sexp* read_aux(jmp_buf trap, char* token) {
+static const struct sexp* read_aux(jmp_buf trap, struct source* source, const char* token) {
     if (STR_EQ("", token)) {
-        free(token);
-        fprintf(stderr, "Unexpected end of data.");
-        fflush(stderr);
+        fprintf(error_stream(), "Unexpected end of data.");
+        fflush(error_stream());
         longjmp(trap, TRAP_ILLARG);
     } else {
         if (STR_EQ("(", token)) {
-            free(token);
-            token = fgettoken(trap, stdin);
+            token = gettoken(trap, source);
             if (STR_EQ(")", token)) {
-                free(token);
                 return NIL();
             } else {
-                return cons(read_aux(trap, token), read_cdr(trap));
+                const struct sexp* x = read_aux(trap, source, token);
+                return cons(x, read_cdr(trap, source));
             }
         } else {
-            const struct sexp* exp = symbol(token);
-            free(token);
-            return exp;
+            return atom_of(trap, token);
         }
     }
 }
 
-static const struct sexp* read_cdr(jmp_buf trap) {
-    char* token = fgettoken(trap, stdin);
-    if (STR_EQ("", token)) {
-        free(token);
-        fprintf(stderr, "Unexpected end of data.");
-        fflush(stderr);
+/* fixnum if token is a numeral (digits optionally preceded by `-`), otherwise symbol. */
+static const struct sexp* atom_of(jmp_buf trap, const char* token) {
+    const char* p = token + (*token == '-');
+    if (!*p) {
+        return symbol(token);
+    }
+    for (; *p; ++p) {
+        if (*p < '0' || '9' < *p) {
+            return symbol(token);
+        }
+    }
+    errno = 0;
+    const long long n = strtoll(token, NULL, 10);
+    if (errno == ERANGE || n < FIXNUM_MIN || FIXNUM_MAX < n) {
+        fprintf(error_stream(), "Integer out of range: %s", token);
+        fflush(error_stream());
         longjmp(trap, TRAP_ILLARG);
-    } else {
-        if (STR_EQ(")", token)) {
-            free(token);
-            return NIL();
-        } else {
-            if (STR_EQ(":", token)) {
-                free(token);
-                const struct sexp* y = read_aux(trap, fgettoken(trap, stdin));
-                token = fgettoken(trap, stdin);
-                if (!STR_EQ(")", token)) {
-                    fprintf(stderr, "Unexpected token %s where expected ')' after %s.", token, text(y));
-                    fflush(stderr);
-                    free(token);
-                    longjmp(trap, TRAP_NOTPAIR);
-                } else {
-                    free(token);
-                    return y;
-                }
-            } else {
-                return cons(read_aux(trap, token), read_cdr(trap));
+    }
+    return fixnum(n);
+}
+
+/* read rest of list after `(` and its first element; elements are collected in reverse, so long list does not nest calls. */
+static const struct sexp* read_cdr(jmp_buf trap, struct source* source) {
+    const struct sexp* xs = NIL();
+    const struct sexp* tail = NIL();
+    while (true) {
+        const char* token = gettoken(trap, source);
+        if (STR_EQ("", token)) {
+            fprintf(error_stream(), "Unexpected end of data.");
+            fflush(error_stream());
+            longjmp(trap, TRAP_ILLARG);
+        } else if (STR_EQ(")", token)) {
+            break;
+        } else if (STR_EQ(":", token)) {
+            const struct sexp* y = read_aux(trap, source, gettoken(trap, source));
+            token = gettoken(trap, source);
+            if (!STR_EQ(")", token)) {
+                char* p = text(y);
+                fprintf(error_stream(), "Unexpected token %s where expected ')' after %s.", token, p);
+                fflush(error_stream());
+                free(p);
+                longjmp(trap, TRAP_NOTPAIR);
             }
+            tail = y;
+            break;
+        } else {
+            xs = cons(read_aux(trap, source, token), xs);
         }
     }
+    for (; !nil(xs); xs = snd(xs)) {
+        tail = cons(fst(xs), tail);
+    }
+    return tail;
 }
 
-static char* fgettoken(jmp_buf trap, FILE* fp) {
-    char *p;
-    size_t n;
-    FILE* mem = open_memstream(&p, &n);
-    fgettok_begin(trap, fp, mem);
-    fclose(mem);
-    return p;
+/* consume next character of source, or return EOF. */
+static int next(struct source* source) {
+    if (source->p == source->end) {
+        if (!source->buffer) {
+            return EOF;
+        }
+        source->p = source->buffer;
+        source->end = source->buffer + freadsome(source->fp, source->buffer, BUFFER_SIZE);
+        if (source->p == source->end) {
+            return EOF;
+        }
+    }
+    return (unsigned char) *source->p++;
 }
 
-static void fgettok_normal(jmp_buf trap, FILE* fin, FILE* fout, bool trailing) {
-    const int c = fgetc(fin);
-    switch (c) {
-    default:
-        fputc(c, fout);
-        return fgettok_trail(trap, fin, fout);
-    case ' ':
-    case '\t':
-    case '\n':
-        return trailing ? (void) 0 : fgettok_begin(trap, fin, fout);
-    case '\\':
-        return fgettok_escape(trap, fin, fout);
-    case '(':
-    case ':':
-    case ')':
-        return (void) (trailing ? ungetc(c, fin) : fputc(c, fout));
-    case EOF:
-        return;
+static void append(struct source* source, size_t* n, int c) {
+    if (*n + 1 == source->token_capacity) {
+        source->token_capacity *= 2;
+        source->token = realloc(source->token, source->token_capacity);
     }
+    source->token[(*n)++] = c;
 }
 
-static void fgettok_escape(jmp_buf trap, FILE* fin, FILE* fout) {
-    const int c = fgetc(fin);
-    switch (c) {
-    case ' ':
-    case '\t':
-    case '\\':
-    case '(':
-    case ':':
-    case ')':
-        fputc(c, fout);
-        // $FALL-THROUGH$
-    case '\n':
-        return fgettok_trail(trap, fin, fout);
-    case EOF:
-        return;
-    default:
-        fprintf(stderr, "Unknown escape character: %c\n", c);
-        fflush(stderr);
-        longjmp(trap, TRAP_ILLARG);
+static const char* finish(struct source* source, size_t n) {
+    source->token[n] = '\0';
+    return source->token;
+}
+
+/*
+ * Scan next token: a parenthesis, a colon or a name. Name ends before white space or parenthesis or colon,
+ * and backslash escapes them (or continues name to next line). Return "" at end of input.
+ */
+static const char* gettoken(jmp_buf trap, struct source* source) {
+    size_t n = 0;
+    bool trailing = false;
+    while (true) {
+        const int c = next(source);
+        switch (c) {
+        default:
+            append(source, &n, c);
+            trailing = true;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+            if (trailing) {
+                return finish(source, n);
+            }
+            break;
+        case '\\': {
+            const int e = next(source);
+            switch (e) {
+            case ' ':
+            case '\t':
+            case '\\':
+            case '(':
+            case ':':
+            case ')':
+                append(source, &n, e);
+                // $FALL-THROUGH$
+            case '\n':
+                trailing = true;
+                break;
+            case EOF:
+                return finish(source, n);
+            default:
+                fprintf(error_stream(), "Unknown escape character: %c\n", e);
+                fflush(error_stream());
+                longjmp(trap, TRAP_ILLARG);
+            }
+            break;
+        }
+        case '(':
+        case ':':
+        case ')':
+            if (trailing) {
+                source->p -= 1; // left for next token.
+            } else {
+                append(source, &n, c);
+            }
+            return finish(source, n);
+        case EOF:
+            return finish(source, n);
+        }
     }
 }
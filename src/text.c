@@ -6,49 +6,129 @@
 
 extern const char* name_of(const struct sexp* exp);
 
-static void fwrite_car(FILE* fp, const struct sexp* exp);
-static void fwrite_cdr(FILE* fp, const struct sexp* exp);
-static void fwrite_pair(FILE* fp, const struct sexp* exp, const char* prefix);
+/* growable output buffer; text is built here then written at once. */
+struct buffer {
+    char* p;
+    size_t length;
+    size_t capacity;
+};
+
+/* list being written: `rest` is not written yet, and `count` elements are. */
+struct open_list {
+    const struct sexp* rest;
+    size_t count;
+};
+
+/* 0 means no limit. */
+struct limits {
+    size_t length;
+    size_t level;
+};
+
+/* limits set by set_print_limits. */
+static _Thread_local struct limits limits;
+
+static void build(struct buffer* buffer, const struct sexp* exp, struct limits limits);
+
+/* sink of error messages set by set_error_stream, or NULL for stderr. */
+static _Thread_local FILE* errors;
+
+void set_error_stream(FILE* fp) {
+    errors = fp;
+}
+
+FILE* error_stream() {
+    if (errors) {
+        return errors;
+    }
+    fflush(stdout); // values written before the error come first, even if stdout is fully buffered.
+    return stderr;
+}
+
+void set_print_limits(size_t length, size_t level) {
+    limits.length = length;
+    limits.level = level;
+}
 
 void write(FILE* fp, const struct sexp* exp) {
-    return fwrite_car(fp, exp);
+    char* p = text(exp);
+    fputs(p, fp);
+    free(p);
+}
+
+/* text of exp limited by length and level as set_print_limits does, regardless of limits set by it. */
+char* text_limited(const struct sexp* exp, size_t length, size_t level) {
+    struct buffer buffer = { malloc(64), 0, 64 };
+    build(&buffer, exp, (struct limits){ length, level });
+    buffer.p[buffer.length] = '\0';
+    return buffer.p;
 }
 
 char* text(const struct sexp* exp) {
-    char* p;
-    size_t n;
-    FILE* fp = open_memstream(&p, &n);
-    write(fp, exp);
-    fclose(fp);
-    return p;
+    return text_limited(exp, limits.length, limits.level);
 }
 
-static void fwrite_car(FILE* fp, const struct sexp* exp) {
-    if (atom(exp)) {
-        if (nil(exp)) {
-            fprintf(fp, "()");
-        } else {
-            fprintf(fp, "%s", name_of(exp));
+static void put(struct buffer* buffer, const char* s) {
+    const size_t n = strlen(s);
+    if (buffer->length + n + 1 > buffer->capacity) {
+        while (buffer->length + n + 1 > buffer->capacity) {
+            buffer->capacity *= 2;
         }
-    } else {
-        fwrite_pair(fp, exp, "(");
+        buffer->p = realloc(buffer->p, buffer->capacity);
     }
+    memcpy(buffer->p + buffer->length, s, n);
+    buffer->length += n;
 }
 
-static void fwrite_cdr(FILE* fp, const struct sexp* exp) {
-    if (atom(exp)) {
-        if (nil(exp)) {
-            fprintf(fp, ")");
+/*
+ * Write exp in a loop, keeping lists being written in a stack instead of C stack.
+ * A list nested deeper than limits.level is written as `#`,
+ * and elements of a list after limits.length are written as `...`.
+ */
+static void build(struct buffer* buffer, const struct sexp* exp, struct limits limits) {
+    struct open_list* stack = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+    while (true) {
+        /* write exp as an element. */
+        if (atom(exp)) {
+            put(buffer, nil(exp) ? "()" : name_of(exp));
+        } else if (limits.level && depth >= limits.level) {
+            put(buffer, "#");
         } else {
-            fprintf(fp, ": %s)", name_of(exp));
+            if (depth == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                stack = realloc(stack, sizeof(*stack) * capacity);
+            }
+            stack[depth++] = (struct open_list){ snd(exp), 1 };
+            put(buffer, "(");
+            exp = fst(exp);
+            continue;
         }
-    } else {
-        fwrite_pair(fp, exp, " ");
-    }
-}
 
-inline static void fwrite_pair(FILE* fp, const struct sexp* exp, const char* prefix) {
-    fprintf(fp, "%s", prefix);
-    fwrite_car(fp, fst(exp));
-    fwrite_cdr(fp, snd(exp));
+        /* then go on to next element of innermost list, closing lists ended. */
+        while (depth) {
+            struct open_list* list = stack + depth - 1;
+            if (nil(list->rest)) {
+                put(buffer, ")");
+            } else if (atom(list->rest)) {
+                put(buffer, ": ");
+                put(buffer, name_of(list->rest));
+                put(buffer, ")");
+            } else if (limits.length && list->count >= limits.length) {
+                put(buffer, " ...)");
+            } else {
+                put(buffer, " ");
+                exp = fst(list->rest);
+                list->rest = snd(list->rest);
+                list->count += 1;
+                break;
+            }
+            depth -= 1;
+        }
+        if (!depth) {
+            break;
+        }
+    }
+    free(stack);
 }
@@ -1,11 +1,24 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <setjmp.h>
 
 struct sexp;
 
+/*
+ * Each thread runs its own interpreter: heap, interned symbols, special forms, caches, counters,
+ * print limits, and streams of errors and trace below are of the calling thread.
+ * Sexps must not be passed to other threads, except to be written, read or compared.
+ */
+
+/**
+ * Range of integers fixnum can hold.
+ */
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
 enum TRAPCODE {
   TRAP_NONE,
   TRAP_NOINPUT,
@@ -13,6 +26,7 @@ enum TRAPCODE {
   TRAP_ILLARG,
   TRAP_NOTPAIR,
   TRAP_NOTAPPLICABLE,
+  TRAP_NOFILE,
 };
 
 /**
@@ -39,15 +53,60 @@ bool nil(const struct sexp* sexp);
 bool atom(const struct sexp* sexp);
 
 /**
- * Make symbol sexp.
+ * Get symbol sexp named `name`.
+ *
+ * Symbols are interned: the same name always yields the same object, \
+ * so symbols can be compared by pointer.
  */
 const struct sexp* symbol(const char* name);
 
+/**
+ * Get fixnum sexp of integer n, which must be in [FIXNUM_MIN, FIXNUM_MAX].
+ *
+ * Fixnum is held in the pointer itself, so it takes no memory \
+ * and fixnums of the same value can be compared by pointer.
+ */
+const struct sexp* fixnum(intptr_t n);
+
+/**
+ * Test whether sexp is fixnum or not. Fixnum is atom.
+ */
+bool is_fixnum(const struct sexp* sexp);
+
+/**
+ * Test whether sexp is symbol or not. Symbol is atom.
+ */
+bool is_symbol(const struct sexp* sexp);
+
+/**
+ * Test whether sexp is applicable, i.e. value of lambda, memo or native function.
+ */
+bool is_applicable(const struct sexp* sexp);
+
+/**
+ * Get name of atom as written: name of symbol, or numeral of fixnum.
+ *
+ * Name of fixnum is valid until the next call in the thread.
+ */
+const char* name_of(const struct sexp* sexp);
+
+/**
+ * Return integer value of fixnum sexp.
+ */
+intptr_t fixnum_value(const struct sexp* sexp);
+
 /**
  * Make pair of sexps.
  */
 const struct sexp* cons(const struct sexp* fst, const struct sexp* snd);
 
+/**
+ * Make list of n elements ending with tail, whose pairs are allocated in bulk.
+ *
+ * Elements must be kept reachable by caller until it returns, as allocation may collect garbage.
+ */
+const struct sexp* list_from(size_t n, const struct sexp* const* elements, const struct sexp* tail);
+
 /**
  * Return `car` of sexp.
  */
@@ -58,6 +117,37 @@ const struct sexp* fst(const struct sexp* sexp);
  */
 const struct sexp* snd(const struct sexp* sexp);
 
+/**
+ * Source of expressions to read.
+ */
+struct source;
+
+/**
+ * Open source reading stream fp.
+ *
+ * Regular file is mapped into memory, and others are read through a buffer. \
+ * fp must be kept open until the source is closed.
+ */
+struct source* open_source(FILE* fp);
+
+/**
+ * Open source reading n bytes from p, which must be kept until the source is closed.
+ */
+struct source* string_source(const char* p, size_t n);
+
+/**
+ * Close source and release its buffers.
+ */
+void close_source(struct source* source);
+
+/**
+ * Read expression from source.
+ *
+ * @param trap is a execution state of host, same as `read`.
+ * @return S-expression.
+ */
+const struct sexp* read_source(jmp_buf trap, struct source* source);
+
 /**
  * Read expression from stdin.
  * 
@@ -69,6 +159,67 @@ const struct sexp* snd(const struct sexp* sexp);
  */
 const struct sexp* read(jmp_buf trap);
 
+struct binary_output;
+struct binary_input;
+
+/**
+ * Open stream writing expressions in binary form into fp, which must be kept open until the stream is closed.
+ */
+struct binary_output* open_binary_output(FILE* fp);
+
+/**
+ * Close binary output stream, and release its symbol table. fp is left open.
+ */
+void close_binary_output(struct binary_output* out);
+
+/**
+ * Write expression as a record of binary output stream.
+ *
+ * Names of symbols are written at their first use in the stream, and by number after.
+ * Atoms other than symbol and number are written as symbols of their names, as `write` does.
+ * @return false if it cannot be written.
+ */
+bool write_binary(struct binary_output* out, const struct sexp* exp);
+
+/**
+ * Open stream reading expressions written by `write_binary` from fp, which must be kept open until the stream is closed.
+ */
+struct binary_input* open_binary_input(FILE* fp);
+
+/**
+ * Close binary input stream, and release its symbol table and buffers. fp is left open.
+ */
+void close_binary_input(struct binary_input* in);
+
+/**
+ * Read expression of next record from binary input stream.
+ *
+ * @param trap is a execution state of host. \
+ * TRAP_NOINPUT indicates no record is left. \
+ * TRAP_ILLARG indicates that the stream is not binary form, or ends amongst a record.
+ * @return S-expression, whose lists are allocated in bulk.
+ */
+const struct sexp* read_binary(jmp_buf trap, struct binary_input* in);
+
+/**
+ * Write environment and all objects reachable from it into heap image file.
+ *
+ * Results kept by memoized functions are dropped, as their keys are hashed by address.
+ * @return false if the file cannot be written.
+ */
+bool save_image(const char* path, const struct sexp* env);
+
+/**
+ * Map heap image file written by `save_image` into heap of the calling thread.
+ *
+ * Pages are mapped from the file as they are, and read on demand; if the address the image was written at
+ * is taken, or it has symbols interned already, references are relocated.
+ * Call this before `symbol` to start an interpreter from the image without relocation.
+ * @param env is set to the environment saved.
+ * @return false if the file is not an image or cannot be mapped.
+ */
+bool load_image(const char* path, const struct sexp** env);
+
 /**
  * Evaluate expression on the environment.
  * 
@@ -80,6 +231,136 @@ const struct sexp* read(jmp_buf trap);
  */
 const struct env_exp eval(jmp_buf trap, const struct env_exp env_exp);
 
+/**
+ * Counters of evaluation, summed over all `eval` so far.
+ */
+struct eval_stats {
+  size_t evals;  /* number of expressions evaluated by tree walker. */
+  size_t calls;  /* number of lambdas applied, by tree walker or bytecode. */
+  size_t conses; /* number of pairs allocated. */
+  size_t links;  /* number of environment links traversed to look up symbols. */
+};
+
+/**
+ * Set stream which error messages are written into, or NULL for stderr (default).
+ */
+void set_error_stream(FILE* fp);
+
+/**
+ * Set stream which evaluation is traced into while `*verbose-eval*` is non-nil, or NULL for stdout (default).
+ */
+void set_trace_stream(FILE* fp);
+
+/**
+ * Release heap and tables of the interpreter of calling thread, e.g. before the thread exits.
+ *
+ * Sexps made so far must not be used after. Next call of any function starts a new interpreter.
+ */
+void release_interpreter();
+
+/**
+ * Write value of evaluation into stream, limited by `*print-length*` and `*print-level*` in env
+ * (see `set_print_limits`).
+ */
+void write_value(FILE* fp, const struct sexp* env, const struct sexp* exp);
+
+/**
+ * Evaluate expressions in n bytes from p in turn.
+ *
+ * @param trap is a execution state of host, same as `eval`.
+ * @return environment extended by definitions made, and the value of the last expression (nil if none).
+ */
+const struct env_exp eval_string(jmp_buf trap, const struct sexp* env, const char* p, size_t n);
+
+/**
+ * Function of host, called with list of evaluated arguments and data given to `native`.
+ *
+ * It may throw by longjmp to trap, after writing the message into `error_stream()`.
+ */
+typedef const struct sexp* (*native_function)(jmp_buf trap, const struct sexp* args, void* data);
+
+/**
+ * Make applicable calling function of host f, which lisp code calls as it calls lambda.
+ *
+ * @param name is the name in errors.
+ * @param arity is the number of arguments f takes, or -1 for any. Other length of arguments is TRAP_ILLARG.
+ * Functions are written into heap image by name only; after `load_image`, make them again by the same names.
+ * f may be called from worker threads by `pmap`.
+ */
+const struct sexp* native(const char* name, int arity, native_function f, void* data);
+
+/**
+ * Return environment env extended by definition of symbol named name to value, as `set` does.
+ */
+const struct sexp* define(const struct sexp* env, const char* name, const struct sexp* value);
+
+/**
+ * Get stream which error messages are written into (see `set_error_stream`).
+ * stdout is flushed before stderr is returned, so that an error comes after the values written before it.
+ */
+FILE* error_stream();
+
+/**
+ * Get counters of evaluation.
+ *
+ * Special form `(time expr)` writes the differences made by evaluating expr into stderr.
+ */
+struct eval_stats eval_stats();
+
+/**
+ * Profile calls of lambdas in every `eval`, whether `*profile*` is set or not.
+ *
+ * Without this, calls are profiled in `eval` of environment where `*profile*` is non-nil.
+ */
+void set_profiling(bool on);
+
+/**
+ * Write call count, inclusive and exclusive time of each lambda profiled so far into stream represented by fp,
+ * sorted by exclusive time. Lambda is named by the symbol it was `set` to, or by its source.
+ * Nothing is written if no call is profiled.
+ */
+void profile_report(FILE* fp);
+
+/**
+ * Statistics of the sexp heap.
+ */
+struct gc_stats {
+  size_t objects;     /* number of live objects. */
+  size_t bytes;       /* bytes held by live objects. */
+  size_t collections; /* number of collections run so far. */
+  size_t allocations; /* number of objects allocated so far. */
+};
+
+/**
+ * Reclaim sexps no longer reachable.
+ *
+ * Roots are the sexps referred from the C stack of the calling thread \
+ * (i.e. host variables and active eval frames) and registered static variables.
+ */
+void collect_garbage();
+
+/**
+ * Register static variable at slot as a root, whose sexp is kept until the interpreter is released.
+ */
+void gc_root(const struct sexp** slot);
+
+/**
+ * Set the number of bytes allocated after the last collection which triggers next one.
+ *
+ * Initial value is taken from environment variable ULISP_GC_THRESHOLD, or 4MiB if not set.
+ */
+void set_gc_threshold(size_t bytes);
+
+/**
+ * Get statistics of the sexp heap.
+ */
+struct gc_stats gc_stats();
+
+/**
+ * Write heap statistics and bytes per object of each type into stream represented by fp.
+ */
+void heap_report(FILE* fp);
+
 /**
  * Build text representation of sexp.
  *
@@ -91,3 +372,12 @@ char* text(const struct sexp* sexp);
  * Write sexp into stream represented by fp.
  */
 void write(FILE* fp, const struct sexp* sexp);
+
+/**
+ * Limit text of sexp made by `text` and `write`.
+ *
+ * Elements of a list after the first `length` ones are written as `...`, \
+ * and lists nested deeper than `level` are written as `#`. 0 means no limit. \
+ * `eval` leaves them as they are; values of `*print-length*` and `*print-level*` apply to `write_value` and trace.
+ */
+void set_print_limits(size_t length, size_t level);
@@ -0,0 +1,144 @@
+#include "ulisp.h"
+#include "../src/binary.c"
+#include "../src/read.c"
+#include "../src/data.c"
+#include "../src/text.c"
+
+#define ASSERT_EQ(expect, actual) if (strcmp(expect, actual)) { printf("expect: %s\n""actual: %s\n""@%d\n", expect, actual, __LINE__); ng += 1; } else { ok += 1; }
+#define NOT_REACHED_HERE() { printf("NOT REACHED HERE.\n@%d\n", __LINE__); ng += 1; }
+
+/* read expression from text. */
+static const struct sexp* parse(jmp_buf trap, const char* s) {
+    struct source* source = string_source(s, strlen(s));
+    const struct sexp* exp = read_source(trap, source);
+    close_source(source);
+    return exp;
+}
+
+/* read a record from bytes, and return its trap code and error message written. */
+static int read_bytes(const char* bytes, size_t n, char** message) {
+    jmp_buf trap;
+    FILE* fp = fmemopen((void*) bytes, n, "r");
+    struct binary_input* in = open_binary_input(fp);
+    size_t size;
+    FILE* errors = open_memstream(message, &size);
+    set_error_stream(errors);
+    const int code = setjmp(trap);
+    if (code == TRAP_NONE) {
+        read_binary(trap, in);
+    }
+    set_error_stream(NULL);
+    fclose(errors);
+    close_binary_input(in);
+    fclose(fp);
+    return code;
+}
+
+int main() {
+    unsigned ok = 0, ng = 0;
+    jmp_buf trap;
+    char* p;
+    size_t size;
+
+    /* expressions come back as written; names of symbols are written once. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        const char* const texts[] = {
+            "(quote (a b c))", "(a (b (c: d)) () -5 4611686018427387903 -4611686018427387904)", "a", "42", "()", "(quote (a b c))",
+        };
+        const size_t n = sizeof(texts) / sizeof(*texts);
+        size_t lengths[sizeof(texts) / sizeof(*texts)];
+        FILE* fp = open_memstream(&p, &size);
+        struct binary_output* out = open_binary_output(fp);
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            write_binary(out, parse(trap, texts[i]));
+            fflush(fp);
+            lengths[i] = size;
+        }
+        close_binary_output(out);
+        fclose(fp);
+        if (lengths[5] - lengths[4] >= lengths[0] - sizeof(BINARY_MAGIC) + 1) {
+            NOT_REACHED_HERE();
+        }
+
+        fp = fmemopen(p, size, "r");
+        struct binary_input* in = open_binary_input(fp);
+        for (i = 0; i < n; ++i) {
+            char* q = text(read_binary(trap, in));
+            ASSERT_EQ(texts[i], q);
+            free(q);
+            collect_garbage(); /* symbols of the stream are interned again. */
+        }
+        if (setjmp(trap) != TRAP_NOINPUT) {
+            read_binary(trap, in);
+            NOT_REACHED_HERE();
+        }
+        close_binary_input(in);
+        fclose(fp);
+        free(p);
+    }
+
+    /* long and deeply nested lists are made without recursion; pairs of a list are allocated in bulk. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        const struct sexp* deep = NIL();
+        const struct sexp* values[100000];
+        size_t i;
+        for (i = 0; i < 100000; ++i) {
+            deep = cons(deep, NIL());
+            values[i] = fixnum(i);
+        }
+        const struct sexp* longest = list_from(100000, values, symbol("end"));
+        FILE* fp = open_memstream(&p, &size);
+        struct binary_output* out = open_binary_output(fp);
+        write_binary(out, deep);
+        write_binary(out, longest);
+        close_binary_output(out);
+        fclose(fp);
+
+        fp = fmemopen(p, size, "r");
+        struct binary_input* in = open_binary_input(fp);
+        const struct sexp* x = read_binary(trap, in);
+        for (i = 0; i < 100000 && !atom(x); ++i) {
+            x = fst(x);
+        }
+        ASSERT_EQ("100000 ()", i == 100000 && nil(x) ? "100000 ()" : "other");
+        const size_t conses = cons_count();
+        x = read_binary(trap, in);
+        ASSERT_EQ("100000", conses + 100000 == cons_count() ? "100000" : "other");
+        for (i = 0; i < 100000 && !atom(x) && fixnum_value(fst(x)) == (intptr_t) i; ++i) {
+            x = snd(x);
+        }
+        ASSERT_EQ("end", i == 100000 ? name_of(x) : "other");
+        close_binary_input(in);
+        fclose(fp);
+        free(p);
+    }
+
+    /* broken streams are errors. */
+    {
+        static const char truncated[] = "ulispbin\x05\x04\x02\x02\x01";
+        ASSERT_EQ("TRAP_ILLARG", read_bytes(truncated, sizeof(truncated) - 1, &p) == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+        ASSERT_EQ("Unexpected end of data.", p);
+        free(p);
+
+        static const char unknown_symbol[] = "ulispbin\x02\x03\x00";
+        ASSERT_EQ("TRAP_ILLARG", read_bytes(unknown_symbol, sizeof(unknown_symbol) - 1, &p) == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+        ASSERT_EQ("Malformed binary data.", p);
+        free(p);
+
+        static const char textual[] = "(quote a)";
+        ASSERT_EQ("TRAP_ILLARG", read_bytes(textual, sizeof(textual) - 1, &p) == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+        ASSERT_EQ("Not binary data.", p);
+        free(p);
+
+        ASSERT_EQ("TRAP_NOINPUT", read_bytes("", 0, &p) == TRAP_NOINPUT ? "TRAP_NOINPUT" : "other");
+        free(p);
+    }
+
+    printf("total %d run, NG = %d\n", ok + ng, ng);
+    return -ng;
+}
@@ -17,8 +17,42 @@ int main() {
     { /* check symbol implementation. */
         const struct sexp* p = symbol("hello");
         ASSERT_TRUE(atom(p));
-        ASSERT_TRUE((p->tag == SYMBOL));
-        ASSERT_TRUE((strcmp("hello", (void*) (p+1)) == 0));
+        ASSERT_TRUE((gc_type(p) == SYMBOL));
+        ASSERT_TRUE((strcmp("hello", name_of(p)) == 0));
+    }
+
+    { /* symbols are interned. */
+        ASSERT_TRUE((symbol("hello") == symbol("hello")));
+        ASSERT_TRUE((symbol("hello") != symbol("world")));
+        char name[] = "hello";
+        ASSERT_TRUE((symbol(name) == symbol("hello")));
+    }
+
+    { /* interning survives table growth. */
+        const struct sexp* first = symbol("sym0");
+        char name[16];
+        unsigned i;
+        for (i = 0; i < 1000; ++i) {
+            sprintf(name, "sym%u", i);
+            symbol(name);
+        }
+        ASSERT_TRUE((symbol("sym0") == first));
+        ASSERT_TRUE((strcmp("sym999", name_of(symbol("sym999"))) == 0));
+    }
+
+    { /* fixnums are immediate. */
+        SEXP* n = fixnum(-42);
+        ASSERT_TRUE(is_fixnum(n));
+        ASSERT_TRUE(atom(n));
+        ASSERT_TRUE(!nil(n));
+        ASSERT_TRUE((fixnum_value(n) == -42));
+        ASSERT_TRUE((fixnum(-42) == n));
+        ASSERT_TRUE((fixnum_value(fixnum(FIXNUM_MAX)) == FIXNUM_MAX));
+        ASSERT_TRUE((fixnum_value(fixnum(FIXNUM_MIN)) == FIXNUM_MIN));
+        ASSERT_TRUE(!is_fixnum(NIL()));
+        ASSERT_TRUE(!is_fixnum(symbol("42")));
+        ASSERT_TRUE(!is_symbol(n));
+        ASSERT_TRUE((strcmp("-42", name_of(n)) == 0));
     }
 
     { /* cons'ed sexp. */
@@ -27,15 +61,16 @@ int main() {
         SEXP* cdr = snd(pair);
 
         ASSERT_TRUE(!atom(pair));
-        ASSERT_TRUE((pair->tag == PAIR));
+        ASSERT_TRUE((gc_type(pair) == PAIR));
+        ASSERT_TRUE((((uintptr_t) pair & TAG_MASK) == PAIR_TAG));
 
         ASSERT_TRUE(atom(car));
-        ASSERT_TRUE((car->tag == SYMBOL));
-        ASSERT_TRUE((strcmp("hello", (void*) (car+1)) == 0));
+        ASSERT_TRUE((gc_type(car) == SYMBOL));
+        ASSERT_TRUE((strcmp("hello", name_of(car)) == 0));
 
         ASSERT_TRUE(atom(cdr));
-        ASSERT_TRUE((cdr->tag == SYMBOL));
-        ASSERT_TRUE((strcmp("world", (void*) (cdr+1)) == 0));
+        ASSERT_TRUE((gc_type(cdr) == SYMBOL));
+        ASSERT_TRUE((strcmp("world", name_of(cdr)) == 0));
     }
 
     printf("total %d run, NG = %d\n", ok + ng, ng);
@@ -4,6 +4,7 @@
 #include "../src/data.c"
 #include "../src/text.c"
 
+#include <pthread.h>
 #include <stdlib.h>
 
 #define ASSERT_EQ(expect, actual) if (strcmp(expect, actual)) { printf("expect: %s\n""actual: %s\n""@%d\n", expect, actual, __LINE__); ng += 1; } else { ok += 1; }
@@ -11,6 +12,63 @@
 
 static const struct sexp* LIST(unsigned numElems, ...);
 
+/* (twice x) ; => (x x), test of registered special form. */
+static const struct env_exp form_twice(jmp_buf trap, const struct env_exp env_exp, struct print_context* print_context) {
+    const struct env_exp r = eval_impl(trap, (struct env_exp){ env_exp.env, cadr(trap, env_exp.exp) }, print_context);
+    return (struct env_exp){ r.env, cons(r.exp, cons(r.exp, NIL())) };
+}
+
+/* evaluate (fib n) with its own heap and error stream, then an error. */
+struct worker {
+    unsigned n;
+    char result[32];
+    char* error;
+};
+
+static void* work(void* arg) {
+    struct worker* worker = arg;
+    size_t size;
+    jmp_buf trap;
+    FILE* errors = open_memstream(&worker->error, &size);
+    set_error_stream(errors);
+    if (setjmp(trap)) {
+        fclose(errors);
+        release_interpreter();
+        return NULL;
+    }
+    const struct sexp* env = cons(cons(symbol("t"), symbol("True")), NIL());
+    /* (set (quote fib) (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2))))))) */
+    const struct sexp* x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("fib")),
+                                LIST(3, symbol("lambda"), LIST(1, symbol("n")),
+                                     LIST(3, symbol("cond"), LIST(2, LIST(3, symbol("<"), symbol("n"), fixnum(2)), symbol("n")),
+                                          LIST(2, symbol("t"), LIST(3, symbol("+"),
+                                                                    LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(1))),
+                                                                    LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(2))))))));
+    env = eval(trap, (struct env_exp){ env, x }).env;
+    char* p = text(eval(trap, (struct env_exp){ env, LIST(2, symbol("fib"), fixnum(worker->n)) }).exp);
+    strcpy(worker->result, p);
+    free(p);
+    eval(trap, (struct env_exp){ env, symbol("undefined") });
+    return NULL;
+}
+
+/* evaluate (fib n) on environment loaded from image, with an interpreter of its own. */
+static void* load_work(void* arg) {
+    struct worker* worker = arg;
+    const struct sexp* env;
+    jmp_buf trap;
+    if (setjmp(trap) || !load_image(worker->error, &env)) {
+        release_interpreter();
+        return NULL;
+    }
+    collect_garbage();
+    char* p = text(eval(trap, (struct env_exp){ env, LIST(2, symbol("fib"), fixnum(worker->n)) }).exp);
+    strcpy(worker->result, p);
+    free(p);
+    release_interpreter();
+    return NULL;
+}
+
 int main() {
     unsigned ok = 0, ng = 0;
     jmp_buf trap;
@@ -21,6 +79,8 @@ int main() {
     char* p = 0;
     size_t n;
 
+    setenv("ULISP_THREADS", "4", 1); /* pmap runs in parallel however many cores there are. */
+
     /* ATOM */
     r =  eval(trap, (struct env_exp){ NIL(), NIL() });
     ASSERT_EQ("(())", text(cons(r.env, r.exp)));
@@ -508,6 +568,746 @@ int main() {
     fclose(stderr);
     free(p);
 
+    /* (((lambda (x) (lambda (y) (cons x y))) (quote a)) (quote b)) ; => (a: b), x is resolved to outer frame. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        x = LIST(2, LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("lambda"), LIST(1, symbol("y")), LIST(3, symbol("cons"), symbol("x"), symbol("y")))),
+                         LIST(2, symbol("quote"), symbol("a"))),
+                 LIST(2, symbol("quote"), symbol("b")));
+        r = eval(trap, (struct env_exp){ NIL(), x });
+        ASSERT_EQ("(() a: b)", text(cons(r.env, r.exp)));
+    }
+
+    /* ((lambda (x) x) (quote arg)) with env {(x: global)} ; => arg, parameter shadows captured environment. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("x")), symbol("x")), LIST(2, symbol("quote"), symbol("arg")));
+        r = eval(trap, (struct env_exp){ cons(cons(symbol("x"), symbol("global")), NIL()), x });
+        ASSERT_EQ("(((x: global)): arg)", text(cons(r.env, r.exp)));
+    }
+
+    /* ((lambda (x) (set (quote x) (quote set)) x) (quote arg)) ; => set, body extending environment is not resolved. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        x = LIST(2, LIST(4, symbol("lambda"), LIST(1, symbol("x")),
+                         LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("x")), LIST(2, symbol("quote"), symbol("set"))),
+                         symbol("x")),
+                 LIST(2, symbol("quote"), symbol("arg")));
+        r = eval(trap, (struct env_exp){ NIL(), x });
+        ASSERT_EQ("((): set)", text(cons(r.env, r.exp)));
+    }
+
+    /* (f) with env {(g: later) (f: (lambda () g))} ; => later, callee sees top level definitions of call site. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        const struct sexp* f = eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("lambda"), NIL(), symbol("g")) }).exp;
+        const struct sexp* global = cons(cons(symbol("g"), symbol("later")), cons(cons(symbol("f"), f), NIL()));
+        r = eval(trap, (struct env_exp){ global, LIST(1, symbol("f")) });
+        ASSERT_EQ("later", text(r.exp));
+        /* redefinition shadows memoized lookup of former environment. */
+        r = eval(trap, (struct env_exp){ cons(cons(symbol("g"), symbol("again")), global), LIST(1, symbol("f")) });
+        ASSERT_EQ("again", text(r.exp));
+        r = eval(trap, (struct env_exp){ global, symbol("g") });
+        ASSERT_EQ("later", text(r.exp));
+    }
+
+    /* ((lambda (y) (f)) (quote arg)) with env {(f: (lambda () y))} throws TRAP_NOSYM, callee never sees locals of caller. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE: {
+            const struct sexp* f = eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("lambda"), NIL(), symbol("y")) }).exp;
+            x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("y")), LIST(1, symbol("f"))), LIST(2, symbol("quote"), symbol("arg")));
+            eval(trap, (struct env_exp){ cons(cons(symbol("f"), f), NIL()), x });
+        }
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOSYM:
+            ASSERT_EQ("Value for symbol `y` not found.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* ((lambda (y) (set (quote z) (quote q)) (f)) (quote arg)) throws TRAP_NOSYM as well, after caller extends its frame. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE: {
+            const struct sexp* f = eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("lambda"), NIL(), symbol("y")) }).exp;
+            x = LIST(2, LIST(4, symbol("lambda"), LIST(1, symbol("y")),
+                             LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("z")), LIST(2, symbol("quote"), symbol("q"))),
+                             LIST(1, symbol("f"))),
+                     LIST(2, symbol("quote"), symbol("arg")));
+            eval(trap, (struct env_exp){ cons(cons(symbol("f"), f), NIL()), x });
+        }
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOSYM:
+            ASSERT_EQ("Value for symbol `y` not found.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* (walk xs) loops over a list of one million cells in constant C stack and bounded heap. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (lambda (xs) (cond ((atom xs) (quote done)) (t (walk (cdr xs))))) */
+        const struct sexp* walk = LIST(3, symbol("lambda"), LIST(1, symbol("xs")),
+                                       LIST(3, symbol("cond"),
+                                            LIST(2, LIST(2, symbol("atom"), symbol("xs")), LIST(2, symbol("quote"), symbol("done"))),
+                                            LIST(2, symbol("t"), LIST(2, symbol("walk"), LIST(2, symbol("cdr"), symbol("xs"))))));
+        const struct sexp* global = cons(cons(symbol("walk"), eval(trap, (struct env_exp){ env, walk }).exp), env);
+        const struct sexp* xs = NIL();
+        unsigned i;
+        for (i = 0; i < 1000000; ++i) {
+            xs = cons(NIL(), xs);
+        }
+        collect_garbage();
+        const size_t bytes = gc_stats().bytes;
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("walk"), LIST(2, symbol("quote"), xs)) });
+        ASSERT_EQ("done", text(r.exp));
+        if (gc_stats().bytes > 3 * bytes) {
+            printf("heap grows %zu -> %zu bytes.\n@%d\n", bytes, gc_stats().bytes, __LINE__);
+            ng += 1;
+        } else {
+            ok += 1;
+        }
+        /* tail call leaves environment of the call site. */
+        ASSERT_EQ("((t: True))", text(eval(trap, (struct env_exp){ env, LIST(2, walk, NIL()) }).env));
+    }
+
+    /* lambda body is compiled into code, unless it extends environment. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        r = eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(2, symbol("car"), symbol("x"))) });
+        ASSERT_EQ("*code*", name_of(get_body(trap, r.exp)));
+        r = eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("lambda"), NIL(), LIST(3, symbol("set"), NIL(), NIL())) });
+        ASSERT_EQ("((set () ()))", text(get_body(trap, r.exp)));
+    }
+
+    /* ((lambda (x) (car x)) (quote a)) throws TRAP_NOTPAIR from compiled body as well. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(2, symbol("car"), symbol("x"))), LIST(2, symbol("quote"), symbol("a")));
+            eval(trap, (struct env_exp){ NIL(), x });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOTPAIR:
+            ASSERT_EQ("`a` is not pair.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* ((lambda (x y) x) (quote a)) called from compiled code and by the tree walker throws TRAP_ILLARG with parameters and arguments. */
+    unsigned i;
+    for (i = 0; i < 2; ++i) {
+        compiling = i == 0;
+        stderr = open_memstream(&p, &n);
+        switch (setjmp(trap)) {
+            case TRAP_NONE:
+                /* ((lambda (f) (f (quote a))) (lambda (x y) x)) */
+                x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("f")), LIST(2, symbol("f"), LIST(2, symbol("quote"), symbol("a")))),
+                         LIST(3, symbol("lambda"), LIST(2, symbol("x"), symbol("y")), symbol("x")));
+                eval(trap, (struct env_exp){ NIL(), x });
+                /* $FALL-THROUGH$ */
+            default:
+                NOT_REACHED_HERE();
+                break;
+            case TRAP_ILLARG:
+                ASSERT_EQ("List length mismatch.: (x y) v.s. (a)", p);
+                break;
+        }
+        fclose(stderr);
+        free(p);
+    }
+    compiling = true;
+
+    /* compiled and tree walked bodies agree; map over list with closure of outer frame. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (lambda (f xs) (cond ((atom xs) xs) (t (cons (f (car xs)) (map f (cdr xs)))))) */
+        const struct sexp* map = LIST(3, symbol("lambda"), LIST(2, symbol("f"), symbol("xs")),
+                                      LIST(3, symbol("cond"),
+                                           LIST(2, LIST(2, symbol("atom"), symbol("xs")), symbol("xs")),
+                                           LIST(2, symbol("t"), LIST(3, symbol("cons"),
+                                                                     LIST(2, symbol("f"), LIST(2, symbol("car"), symbol("xs"))),
+                                                                     LIST(3, symbol("map"), symbol("f"), LIST(2, symbol("cdr"), symbol("xs")))))));
+        /* ((lambda (y) (map (lambda (x) (cons x y)) (quote (a b c)))) (quote z)) */
+        x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("y")),
+                         LIST(3, symbol("map"), LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("cons"), symbol("x"), symbol("y"))),
+                              LIST(2, symbol("quote"), LIST(3, symbol("a"), symbol("b"), symbol("c"))))),
+                 LIST(2, symbol("quote"), symbol("z")));
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            const struct sexp* global = cons(cons(symbol("map"), eval(trap, (struct env_exp){ env, map }).exp), env);
+            r = eval(trap, (struct env_exp){ global, x });
+            ASSERT_EQ("((a: z) (b: z) (c: z))", text(r.exp));
+        }
+        compiling = true;
+    }
+
+    /* arithmetic on fixnums, by the tree walker and compiled code alike. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (lambda (n a) (cond ((< n 1) a) (t (fact (- n 1) (* a n))))) */
+        const struct sexp* fact = LIST(3, symbol("lambda"), LIST(2, symbol("n"), symbol("a")),
+                                       LIST(3, symbol("cond"),
+                                            LIST(2, LIST(3, symbol("<"), symbol("n"), fixnum(1)), symbol("a")),
+                                            LIST(2, symbol("t"), LIST(3, symbol("fact"),
+                                                                      LIST(3, symbol("-"), symbol("n"), fixnum(1)),
+                                                                      LIST(3, symbol("*"), symbol("a"), symbol("n"))))));
+        /* (lambda (x) (cons (+) (cons (- x) (cons (+ x 1 2) (cons (- x 1 2) (= x 3)))))) */
+        const struct sexp* misc = LIST(3, symbol("lambda"), LIST(1, symbol("x")),
+                                       LIST(3, symbol("cons"), LIST(1, symbol("+")),
+                                            LIST(3, symbol("cons"), LIST(2, symbol("-"), symbol("x")),
+                                                 LIST(3, symbol("cons"), LIST(4, symbol("+"), symbol("x"), fixnum(1), fixnum(2)),
+                                                      LIST(3, symbol("cons"), LIST(4, symbol("-"), symbol("x"), fixnum(1), fixnum(2)),
+                                                           LIST(3, symbol("="), symbol("x"), fixnum(3)))))));
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            const struct sexp* global = cons(cons(symbol("fact"), eval(trap, (struct env_exp){ env, fact }).exp), env);
+            r = eval(trap, (struct env_exp){ global, LIST(3, symbol("fact"), fixnum(20), fixnum(1)) });
+            ASSERT_EQ("2432902008176640000", text(r.exp));
+            r = eval(trap, (struct env_exp){ env, LIST(2, misc, fixnum(3)) });
+            ASSERT_EQ("(0 -3 6 0: True)", text(r.exp));
+        }
+        compiling = true;
+    }
+
+    /* arithmetic allocates nothing. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (< (* 3 4) (- 20 2 -1)) */
+        x = LIST(3, symbol("<"), LIST(3, symbol("*"), fixnum(3), fixnum(4)), LIST(4, symbol("-"), fixnum(20), fixnum(2), fixnum(-1)));
+        const size_t objects = gc_stats().objects;
+        r = eval(trap, (struct env_exp){ env, x });
+        ASSERT_EQ("True", text(r.exp));
+        if (gc_stats().objects != objects) {
+            printf("%zu objects allocated.\n@%d\n", gc_stats().objects - objects, __LINE__);
+            ng += 1;
+        } else {
+            ok += 1;
+        }
+    }
+
+    /* built-in list functions, by the tree walker and compiled code alike. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (lambda (xs ys) (list (length xs) (reverse (append xs ys ys)) (nth 1 xs) (nth 2 xs)
+         *                       (assoc (quote (b)) (list (cons (quote a) 1) (quote c) (cons (quote (b)) 2)))
+         *                       (eq (car xs) (quote a)) (null ys) (null (list)))) */
+        const struct sexp* f = LIST(3, symbol("lambda"), LIST(2, symbol("xs"), symbol("ys")),
+                                    LIST(9, symbol("list"),
+                                         LIST(2, symbol("length"), symbol("xs")),
+                                         LIST(2, symbol("reverse"), LIST(4, symbol("append"), symbol("xs"), symbol("ys"), symbol("ys"))),
+                                         LIST(3, symbol("nth"), fixnum(1), symbol("xs")),
+                                         LIST(3, symbol("nth"), fixnum(2), symbol("xs")),
+                                         LIST(3, symbol("assoc"), LIST(2, symbol("quote"), LIST(1, symbol("b"))),
+                                              LIST(4, symbol("list"),
+                                                   LIST(3, symbol("cons"), LIST(2, symbol("quote"), symbol("a")), fixnum(1)),
+                                                   LIST(2, symbol("quote"), symbol("c")),
+                                                   LIST(3, symbol("cons"), LIST(2, symbol("quote"), LIST(1, symbol("b"))), fixnum(2)))),
+                                         LIST(3, symbol("eq"), LIST(2, symbol("car"), symbol("xs")), LIST(2, symbol("quote"), symbol("a"))),
+                                         LIST(2, symbol("null"), symbol("ys")),
+                                         LIST(2, symbol("null"), LIST(1, symbol("list")))));
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            r = eval(trap, (struct env_exp){ env, LIST(3, f, LIST(2, symbol("quote"), LIST(2, symbol("a"), symbol("b"))),
+                                                       LIST(2, symbol("quote"), LIST(1, symbol("c")))) });
+            ASSERT_EQ("(2 (c c b a) b () ((b): 2) True () True)", text(r.exp));
+        }
+        compiling = true;
+
+        /* (append (quote (a)) (quote b)) shares its last argument, which may be any value. */
+        r = eval(trap, (struct env_exp){ env, LIST(3, symbol("append"), LIST(2, symbol("quote"), LIST(1, symbol("a"))),
+                                                   LIST(2, symbol("quote"), symbol("b"))) });
+        ASSERT_EQ("(a: b)", text(r.exp));
+
+        /* built-in functions are values passed as arguments, and definitions of their names shadow them. */
+        /* (lambda (g x) (cons (g x) (length x))) */
+        f = LIST(3, symbol("lambda"), LIST(2, symbol("g"), symbol("x")),
+                 LIST(3, symbol("cons"), LIST(2, symbol("g"), symbol("x")), LIST(2, symbol("length"), symbol("x"))));
+        /* (lambda (x) (quote mine)) */
+        const struct sexp* mine = LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(2, symbol("quote"), symbol("mine")));
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            x = LIST(3, f, symbol("null"), NIL());
+            r = eval(trap, (struct env_exp){ env, x });
+            ASSERT_EQ("(True: 0)", text(r.exp));
+            r = eval(trap, (struct env_exp){ cons(cons(symbol("length"), eval(trap, (struct env_exp){ env, mine }).exp), env), x });
+            ASSERT_EQ("(True: mine)", text(r.exp));
+        }
+        compiling = true;
+    }
+
+    /* (length (quote (a: b))) throws TRAP_NOTPAIR, and (reverse) throws TRAP_ILLARG. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ env, LIST(2, symbol("length"), LIST(2, symbol("quote"), cons(symbol("a"), symbol("b")))) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOTPAIR:
+            ASSERT_EQ("`(a: b)` is not list.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ env, LIST(1, symbol("reverse")) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_ILLARG:
+            ASSERT_EQ("List length mismatch.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* (time (cons (quote a) (quote b))) writes time and counters spent by its argument into stderr. */
+    stderr = open_memstream(&p, &n);
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        x = LIST(2, symbol("time"), LIST(3, symbol("cons"), LIST(2, symbol("quote"), symbol("a")), LIST(2, symbol("quote"), symbol("b"))));
+        r = eval(trap, (struct env_exp){ env, x });
+        ASSERT_EQ("(a: b)", text(r.exp));
+    }
+    fclose(stderr);
+    {
+        double wall, cpu;
+        size_t evals, calls, conses, links;
+        const int scanned = sscanf(p, "time: %lf ms wall, %lf ms cpu, %zu evals, %zu calls, %zu conses, %zu links\n",
+                                   &wall, &cpu, &evals, &calls, &conses, &links);
+        char counts[128];
+        sprintf(counts, "%d %zu %zu %zu %zu", scanned, evals, calls, conses, links);
+        ASSERT_EQ("6 3 0 1 0", counts);
+    }
+    free(p);
+
+    /* profile counts calls of lambda named by `set`, through tail calls of the tree walker and bytecode. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (set (quote count) (lambda (xs) (cond ((atom xs) xs) (t (count (cdr xs)))))) */
+        x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("count")),
+                 LIST(3, symbol("lambda"), LIST(1, symbol("xs")),
+                      LIST(3, symbol("cond"), LIST(2, LIST(2, symbol("atom"), symbol("xs")), symbol("xs")),
+                           LIST(2, symbol("t"), LIST(2, symbol("count"), LIST(2, symbol("cdr"), symbol("xs")))))));
+        const struct sexp* global = cons(cons(symbol("*profile*"), symbol("t")), env);
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            global = eval(trap, (struct env_exp){ global, x }).env;
+            eval(trap, (struct env_exp){ global, LIST(2, symbol("count"), LIST(2, symbol("quote"), LIST(3, fixnum(1), fixnum(2), fixnum(3)))) });
+        }
+        compiling = true;
+        FILE* out = open_memstream(&p, &n);
+        profile_report(out);
+        fclose(out);
+        size_t calls = 0;
+        char name[16] = "";
+        sscanf(strchr(p, '\n') + 1, "%zu %*f %*f %15s", &calls, name);
+        ASSERT_EQ("count", name);
+        ASSERT_EQ("8", (sprintf(name, "%zu", calls), name));
+        free(p);
+    }
+
+    /* calls left by error are finished, so that later calls of the same lambda take inclusive time again. */
+    stderr = open_memstream(&p, &n);
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (set (quote first) (lambda (x) (car x))) */
+        x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("first")),
+                 LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(2, symbol("car"), symbol("x"))));
+        const struct sexp* global = eval(trap, (struct env_exp){ cons(cons(symbol("*profile*"), symbol("t")), env), x }).env;
+        struct profile_entry* entry = profile_entry(find(trap, symbol("first"), global));
+        char counts[64];
+        jmp_buf trap2;
+        if (setjmp(trap2) != TRAP_NOTPAIR) {
+            eval(trap2, (struct env_exp){ global, LIST(2, symbol("first"), LIST(2, symbol("quote"), symbol("a"))) });
+            NOT_REACHED_HERE();
+        }
+        ASSERT_EQ("0 0", (sprintf(counts, "%u %zu", entry->active, profile.depth), counts));
+        const double total = entry->total;
+        eval(trap, (struct env_exp){ global, LIST(2, symbol("first"), LIST(2, symbol("quote"), LIST(1, symbol("a")))) });
+        ASSERT_EQ("2 True", (sprintf(counts, "%zu %s", entry->calls, entry->total > total ? "True" : "()"), counts));
+    }
+    fclose(stderr);
+    free(p);
+
+    /* ((lambda (a: b) b) 1 2 3) binds rest of arguments to dotted parameter, by the tree walker as well. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            compiling = i == 0;
+            x = LIST(4, LIST(3, symbol("lambda"), cons(symbol("a"), symbol("b")), symbol("b")), fixnum(1), fixnum(2), fixnum(3));
+            ASSERT_EQ("(2 3)", text(eval(trap, (struct env_exp){ env, x }).exp));
+        }
+        compiling = true;
+    }
+
+    /* (memo f) calls f once for each structure of arguments, and the least recently used result is dropped. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        /* (set (quote fib) (memo (lambda (n) (cond ((< n 2) n) (t (+ (fib (- n 1)) (fib (- n 2)))))))) */
+        x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("fib")),
+                 LIST(2, symbol("memo"),
+                      LIST(3, symbol("lambda"), LIST(1, symbol("n")),
+                           LIST(3, symbol("cond"), LIST(2, LIST(3, symbol("<"), symbol("n"), fixnum(2)), symbol("n")),
+                                LIST(2, symbol("t"), LIST(3, symbol("+"),
+                                                          LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(1))),
+                                                          LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(2)))))))));
+        const struct sexp* global = eval(trap, (struct env_exp){ env, x }).env;
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("fib"), fixnum(90)) });
+        ASSERT_EQ("2880067194370816120", text(r.exp));
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("memo-stats"), symbol("fib")) });
+        ASSERT_EQ("(88 91 91 256)", text(r.exp));
+
+        /* (set (quote pair) (memo (lambda (x) (cons x x)) 2)) */
+        x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("pair")),
+                 LIST(3, symbol("memo"), LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("cons"), symbol("x"), symbol("x"))), fixnum(2)));
+        global = eval(trap, (struct env_exp){ env, x }).env;
+        const struct sexp* ab = eval(trap, (struct env_exp){ global, LIST(2, symbol("pair"), LIST(2, symbol("quote"), LIST(2, symbol("a"), symbol("b")))) }).exp;
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("pair"), LIST(2, symbol("quote"), LIST(2, symbol("a"), symbol("b")))) });
+        ASSERT_EQ("same", r.exp == ab ? "same" : "other"); /* equal arguments hit. */
+        eval(trap, (struct env_exp){ global, LIST(2, symbol("pair"), fixnum(1)) });
+        eval(trap, (struct env_exp){ global, LIST(2, symbol("pair"), fixnum(2)) });
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("pair"), LIST(2, symbol("quote"), LIST(2, symbol("a"), symbol("b")))) });
+        ASSERT_EQ("other", r.exp == ab ? "same" : "other"); /* evicted. */
+        r = eval(trap, (struct env_exp){ global, LIST(2, symbol("memo-stats"), symbol("pair")) });
+        ASSERT_EQ("(1 4 2 2)", text(r.exp));
+    }
+
+    /* (memo (quote f)) throws TRAP_ILLARG. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ NIL(), LIST(2, symbol("memo"), LIST(2, symbol("quote"), symbol("f"))) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_ILLARG:
+            ASSERT_EQ("Illegal argument: (memo (quote f))", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* (pmap f xs chunk) returns values in order, which may be closures made by workers. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        const struct sexp* xs = LIST(2, symbol("quote"), LIST(5, fixnum(1), fixnum(2), fixnum(3), fixnum(4), fixnum(5)));
+        x = LIST(4, symbol("pmap"), LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("cons"), symbol("x"), LIST(2, symbol("quote"), symbol("a")))),
+                 xs, fixnum(2));
+        ASSERT_EQ("((1: a) (2: a) (3: a) (4: a) (5: a))", text(eval(trap, (struct env_exp){ env, x }).exp));
+
+        /* (set (quote adders) (pmap (lambda (x) (lambda (y) (+ x y))) xs 1)) */
+        x = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("adders")),
+                 LIST(4, symbol("pmap"),
+                      LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("lambda"), LIST(1, symbol("y")), LIST(3, symbol("+"), symbol("x"), symbol("y")))),
+                      xs, fixnum(1)));
+        const struct sexp* global = eval(trap, (struct env_exp){ env, x }).env;
+        x = LIST(2, LIST(2, symbol("car"), LIST(2, symbol("cdr"), symbol("adders"))), fixnum(10));
+        ASSERT_EQ("12", text(eval(trap, (struct env_exp){ global, x }).exp));
+    }
+
+    /* error of the first chunk failed is thrown by pmap. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            x = LIST(4, symbol("pmap"), LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(2, symbol("car"), symbol("x"))),
+                     LIST(2, symbol("quote"), LIST(4, LIST(1, fixnum(1)), fixnum(2), LIST(1, fixnum(3)), fixnum(4))), fixnum(1));
+            eval(trap, (struct env_exp){ env, x });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOTPAIR:
+            ASSERT_EQ("`2` is not pair.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* (pmap (quote f) (quote (1))) throws TRAP_ILLARG. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("pmap"), LIST(2, symbol("quote"), symbol("f")), LIST(2, symbol("quote"), LIST(1, fixnum(1)))) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_ILLARG:
+            ASSERT_EQ("Illegal argument: (pmap (quote f) (quote (1)))", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* threads run interpreters of their own, with their own error streams. */
+    {
+        pthread_t threads[4];
+        struct worker workers[4];
+        unsigned i;
+        for (i = 0; i < 4; ++i) {
+            workers[i] = (struct worker){ .n = 10 + i };
+            pthread_create(threads + i, NULL, work, workers + i);
+        }
+        const char* const fibs[] = { "55", "89", "144", "233" };
+        for (i = 0; i < 4; ++i) {
+            pthread_join(threads[i], NULL);
+            ASSERT_EQ(fibs[i], workers[i].result);
+            ASSERT_EQ("Value for symbol `undefined` not found.", workers[i].error);
+            free(workers[i].error);
+        }
+        ASSERT_EQ("True", text(eval(trap, (struct env_exp){ env, symbol("t") }).exp)); /* this thread is intact. */
+    }
+
+    /* (save-image "path") writes environment, which is loaded by a fresh interpreter as it is, or relocated. */
+    {
+        static char path[] = "/tmp/ulisp-test-eval.img";
+        const struct sexp* fib = LIST(3, symbol("set"), LIST(2, symbol("quote"), symbol("fib")),
+                                      LIST(2, symbol("memo"), LIST(3, symbol("lambda"), LIST(1, symbol("n")),
+                                           LIST(3, symbol("cond"), LIST(2, LIST(3, symbol("<"), symbol("n"), fixnum(2)), symbol("n")),
+                                                LIST(2, symbol("t"), LIST(3, symbol("+"),
+                                                                          LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(1))),
+                                                                          LIST(2, symbol("fib"), LIST(3, symbol("-"), symbol("n"), fixnum(2)))))))));
+        const struct sexp* saved = eval(trap, (struct env_exp){ env, fib }).env;
+        eval(trap, (struct env_exp){ saved, LIST(2, symbol("fib"), fixnum(20)) });
+        r = eval(trap, (struct env_exp){ saved, LIST(2, symbol("save-image"), symbol("\"/tmp/ulisp-test-eval.img\"")) });
+        ASSERT_EQ("()", text(r.exp));
+
+        pthread_t thread;
+        struct worker worker = { .n = 30, .error = path };
+        pthread_create(&thread, NULL, load_work, &worker);
+        pthread_join(thread, NULL);
+        ASSERT_EQ("832040", worker.result);
+
+        /* symbols interned already, and the second one mapped elsewhere as the first is there. */
+        const struct sexp* loaded[2];
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            if (!load_image(path, loaded + i)) {
+                NOT_REACHED_HERE();
+                loaded[i] = saved;
+            }
+        }
+        collect_garbage();
+        ASSERT_EQ("6765", text(eval(trap, (struct env_exp){ loaded[0], LIST(2, symbol("fib"), fixnum(20)) }).exp));
+        ASSERT_EQ("75025", text(eval(trap, (struct env_exp){ loaded[1], LIST(2, symbol("fib"), fixnum(25)) }).exp));
+        ASSERT_EQ("True", text(eval(trap, (struct env_exp){ loaded[1], symbol("t") }).exp));
+        remove(path);
+
+        const struct sexp* dummy;
+        if (load_image(path, &dummy)) {
+            NOT_REACHED_HERE();
+        }
+    }
+
+    /* (write-binary x) writes value of x into stdout, which (read-binary) reads from stdin. */
+    {
+        FILE* const out = stdout;
+        FILE* const in = stdin;
+        char* q;
+        stdout = open_memstream(&p, &n);
+        r = eval(trap, (struct env_exp){ env, LIST(2, symbol("write-binary"), LIST(2, symbol("quote"), LIST(3, symbol("a"), fixnum(-1), LIST(1, symbol("a"))))) });
+        ASSERT_EQ("(a -1 (a))", text(r.exp));
+        fclose(stdout);
+        stdout = out;
+        stdin = fmemopen(p, n, "r");
+        ASSERT_EQ("(a -1 (a))", text(eval(trap, (struct env_exp){ env, LIST(1, symbol("read-binary")) }).exp));
+        stderr = open_memstream(&q, &n);
+        switch (setjmp(trap)) {
+            case TRAP_NONE:
+                eval(trap, (struct env_exp){ env, LIST(1, symbol("read-binary")) });
+                NOT_REACHED_HERE();
+                break;
+            case TRAP_ILLARG:
+                break;
+            default:
+                NOT_REACHED_HERE();
+        }
+        fclose(stderr);
+        ASSERT_EQ("Unexpected end of data.", q);
+        free(q);
+        fclose(stdin);
+        stdin = in;
+        free(p);
+    }
+
+    /* (+ 1 x) throws TRAP_ILLARG unless x is number, from compiled body as well. */
+    {
+        unsigned i;
+        for (i = 0; i < 2; ++i) {
+            stderr = open_memstream(&p, &n);
+            switch (setjmp(trap)) {
+                case TRAP_NONE:
+                    compiling = i == 0;
+                    x = LIST(2, LIST(3, symbol("lambda"), LIST(1, symbol("x")), LIST(3, symbol("+"), fixnum(1), symbol("x"))),
+                             LIST(2, symbol("quote"), symbol("a")));
+                    eval(trap, (struct env_exp){ NIL(), x });
+                    /* $FALL-THROUGH$ */
+                default:
+                    NOT_REACHED_HERE();
+                    break;
+                case TRAP_ILLARG:
+                    ASSERT_EQ("`a` is not number.", p);
+                    break;
+            }
+            fclose(stderr);
+            free(p);
+        }
+        compiling = true;
+    }
+
+    /* (* FIXNUM_MAX 2) throws TRAP_ILLARG. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ NIL(), LIST(3, symbol("*"), fixnum(FIXNUM_MAX), fixnum(2)) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_ILLARG:
+            ASSERT_EQ("Integer overflow.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* (load "path") evaluates expressions in file, and extends environment by them. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        char path[] = "/tmp/ulisp-test-XXXXXX";
+        FILE* fp = fdopen(mkstemp(path), "w");
+        fprintf(fp, "(set (quote hello) (quote world))\n(cons hello hello)\n");
+        fclose(fp);
+        char quoted[sizeof(path) + 2];
+        sprintf(quoted, "\"%s\"", path);
+        r = eval(trap, (struct env_exp){ env, LIST(2, symbol("load"), symbol(quoted)) });
+        ASSERT_EQ("(((hello: world) (t: True)) world: world)", text(cons(r.env, r.exp)));
+        remove(path);
+    }
+
+    /* (load "no/such/file") throws TRAP_NOFILE. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE:
+            eval(trap, (struct env_exp){ env, LIST(2, symbol("load"), symbol("\"no/such/file\"")) });
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_NOFILE:
+            ASSERT_EQ("Cannot open file: no/such/file", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
+    /* registered special form is dispatched as well as builtin ones. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        register_form("twice", form_twice);
+        x = LIST(2, symbol("twice"), LIST(2, symbol("quote"), symbol("ulisp")));
+        r = eval(trap, (struct env_exp){ NIL(), x });
+        ASSERT_EQ("(() ulisp ulisp)", text(cons(r.env, r.exp)));
+    }
+
+    /* trace is written into stdout only while *verbose-eval* is non-nil. */
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+    } else {
+        FILE* const out = stdout;
+        const struct sexp* verbose = cons(cons(symbol("*verbose-eval*"), symbol("True")), NIL());
+        stdout = open_memstream(&p, &n);
+        eval(trap, (struct env_exp){ verbose, LIST(2, symbol("quote"), symbol("ulisp")) });
+        fclose(stdout);
+        ASSERT_EQ("EVALUATE: (quote ulisp)\n|  env.*verbose-eval*=True\n\\___ ulisp\n", p);
+        free(p);
+
+        stdout = open_memstream(&p, &n);
+        eval(trap, (struct env_exp){ cons(cons(symbol("*verbose-eval*"), NIL()), verbose), LIST(2, symbol("quote"), symbol("ulisp")) });
+        fclose(stdout);
+        ASSERT_EQ("", p);
+        free(p);
+
+        /* *print-length* bounds definitions and values written in trace. */
+        stdout = open_memstream(&p, &n);
+        eval(trap, (struct env_exp){ cons(cons(symbol("*print-length*"), fixnum(1)), verbose),
+                                     LIST(2, symbol("quote"), LIST(2, symbol("a"), symbol("b"))) });
+        fclose(stdout);
+        stdout = out;
+        ASSERT_EQ("EVALUATE: (quote ...)\n|  env.*print-length*=1\n|  env...\n\\___ (a ...)\n", p);
+        free(p);
+    }
+
+    /* *print-length* and *print-level* bound write_value, but text and error messages stay whole after evaluation. */
+    stderr = open_memstream(&p, &n);
+    switch (setjmp(trap)) {
+        case TRAP_NONE: {
+            const struct sexp* limited = cons(cons(symbol("*print-level*"), fixnum(1)), cons(cons(symbol("*print-length*"), fixnum(1)), env));
+            x = LIST(2, symbol("quote"), LIST(3, symbol("a"), LIST(1, symbol("b")), symbol("c")));
+            r = eval(trap, (struct env_exp){ limited, x });
+            ASSERT_EQ("(a (b) c)", text(r.exp));
+            char* q;
+            size_t size;
+            FILE* out = open_memstream(&q, &size);
+            write_value(out, limited, LIST(2, r.exp, r.exp));
+            fclose(out);
+            ASSERT_EQ("(# ...)", q);
+            free(q);
+            eval(trap, (struct env_exp){ limited, LIST(2, symbol("+"), x) });
+        }
+            /* $FALL-THROUGH$ */
+        default:
+            NOT_REACHED_HERE();
+            break;
+        case TRAP_ILLARG:
+            ASSERT_EQ("`(a (b) c)` is not number.", p);
+            break;
+    }
+    fclose(stderr);
+    free(p);
+
     stderr = fp;
     printf("total %d run, NG = %d\n", ok + ng, ng);
 
@@ -0,0 +1,132 @@
+#include "ulisp.h"
+#include "../src/gc.c"
+#include "../src/data.c"
+#include "../src/text.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ASSERT_TRUE(x) if (!(x)) { printf("!`" #x "`\n@%d\n", __LINE__); ng += 1; } else { ok += 1; }
+#define ASSERT_EQ(expect, actual) if (strcmp(expect, actual))\
+ { printf("expect: %s\n""actual: %s\n""@%d\n", expect, actual, __LINE__); ng += 1; } else { ok += 1; }
+
+static const struct sexp* global;
+
+static void __attribute__((noinline)) make_garbage(unsigned n) {
+    const struct sexp* xs = NIL();
+    while (n--) {
+        xs = cons(symbol("garbage"), xs);
+    }
+}
+
+static const struct sexp* __attribute__((noinline)) make_list(unsigned n) {
+    char name[16];
+    const struct sexp* xs = NIL();
+    while (n--) {
+        sprintf(name, "x%u", n);
+        xs = cons(symbol(name), xs);
+    }
+    return xs;
+}
+
+int main() {
+    unsigned ok = 0, ng = 0;
+    char* p;
+
+    { /* unreachable pairs are reclaimed. */
+        collect_garbage();
+        const size_t before = gc_stats().objects;
+        const size_t allocations = gc_stats().allocations;
+        gc_pause(true); /* whatever ULISP_GC_THRESHOLD is. */
+        make_garbage(10000);
+        ASSERT_TRUE((gc_stats().objects >= before + 10000));
+        gc_pause(false);
+        collect_garbage();
+        ASSERT_TRUE((gc_stats().objects < before + 100));
+        ASSERT_TRUE((gc_stats().allocations >= allocations + 10000)); /* counts reclaimed ones too. */
+    }
+
+    { /* objects referred from stack survive. */
+        const struct sexp* xs = make_list(1000);
+        make_garbage(10000);
+        collect_garbage();
+        p = text(xs);
+        ASSERT_TRUE((strncmp("(x0 x1 x2 ", p, 10) == 0));
+        ASSERT_TRUE((strcmp("x998 x999)", p + strlen(p) - 10) == 0));
+        free(p);
+        ASSERT_TRUE((fst(snd(xs)) == symbol("x1")));
+    }
+
+    { /* registered roots survive. */
+        gc_root(&global);
+        global = cons(symbol("hello"), symbol("world"));
+        make_garbage(10000);
+        collect_garbage();
+        p = text(global);
+        ASSERT_EQ("(hello: world)", p);
+        free(p);
+    }
+
+    { /* unreferenced symbols are dropped and interned again. */
+        const size_t count = symbols.count;
+        make_list(1000);
+        ASSERT_TRUE((symbols.count >= count));
+        collect_garbage();
+        ASSERT_TRUE((symbols.count < count + 100));
+        ASSERT_EQ("x42", name_of(symbol("x42")));
+    }
+
+    { /* type is derived from page, and pair takes no more than its size. */
+        ASSERT_TRUE((gc_type(cons(NIL(), NIL())) == PAIR));
+        ASSERT_TRUE((gc_type(symbol("hello")) == SYMBOL));
+        ASSERT_TRUE((gc_type(make_applicable(NIL(), NIL(), NIL())) == APPLICABLE));
+        ASSERT_TRUE((gc_bytes_per_object(sizeof(struct pair)) < sizeof(struct pair) + 1));
+    }
+
+    { /* long symbol names get pages of their own. */
+        char name[5000];
+        memset(name, 'a', sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        const struct sexp* x = symbol(name);
+        collect_garbage();
+        ASSERT_TRUE((symbol(name) == x));
+        ASSERT_TRUE((strlen(name_of(x)) == sizeof(name) - 1));
+    }
+
+    { /* allocation beyond threshold triggers collection. */
+        const size_t collections = gc_stats().collections;
+        unsigned i;
+        set_gc_threshold(1 << 16);
+        for (i = 0; i < 100; ++i) {
+            make_garbage(1000);
+        }
+        ASSERT_TRUE((gc_stats().collections > collections));
+        ASSERT_TRUE((gc_stats().bytes < (1 << 20)));
+    }
+
+    { /* lists allocated in runs by list_from trigger collection as well. */
+        const struct sexp* elements[1000];
+        const size_t collections = gc_stats().collections;
+        unsigned i;
+        for (i = 0; i < 1000; ++i) {
+            elements[i] = symbol("garbage");
+        }
+        for (i = 0; i < 100; ++i) {
+            list_from(1000, elements, NIL());
+        }
+        ASSERT_TRUE((gc_stats().collections > collections));
+        ASSERT_TRUE((gc_stats().bytes < (1 << 20)));
+    }
+
+    { /* symbols interned while collection runs stay in the table. */
+        const size_t collections = gc_stats().collections;
+        const struct sexp* xs = make_list(10000);
+        ASSERT_TRUE((gc_stats().collections > collections));
+        for (; !nil(xs) && symbol(name_of(fst(xs))) == fst(xs); xs = snd(xs)) {
+        }
+        ASSERT_TRUE((nil(xs)));
+    }
+
+    printf("total %d run, NG = %d\n", ok + ng, ng);
+    return -ng;
+}
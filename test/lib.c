@@ -0,0 +1,109 @@
+#include "ulisp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* test of libulisp through ulisp.h only, as a host embedding it. */
+
+#define ASSERT_EQ(expect, actual) if (strcmp(expect, actual)) { printf("expect: %s\n""actual: %s\n""@%d\n", expect, actual, __LINE__); ng += 1; } else { ok += 1; }
+#define NOT_REACHED_HERE() { printf("NOT REACHED HERE.\n@%d\n", __LINE__); ng += 1; }
+
+/* (sum x ...) adds numbers, counting calls into data. */
+static const struct sexp* sum(jmp_buf trap, const struct sexp* args, void* data) {
+    intptr_t n = 0;
+    for (; !atom(args); args = snd(args)) {
+        if (!is_fixnum(fst(args))) {
+            fprintf(error_stream(), "`%s` is not number.", name_of(fst(args)));
+            fflush(error_stream());
+            longjmp(trap, TRAP_ILLARG);
+        }
+        n += fixnum_value(fst(args));
+    }
+    *(unsigned*) data += 1;
+    return fixnum(n);
+}
+
+/* (pair x y) conses x and y. */
+static const struct sexp* pair(jmp_buf trap, const struct sexp* args, void* data) {
+    return cons(fst(args), fst(snd(args)));
+}
+
+/* evaluate text, and return the trap code and error message written. */
+static int fail(const struct sexp* env, const char* s, char** message) {
+    jmp_buf trap;
+    size_t size;
+    FILE* errors = open_memstream(message, &size);
+    set_error_stream(errors);
+    const int code = setjmp(trap);
+    if (code == TRAP_NONE) {
+        eval_string(trap, env, s, strlen(s));
+    }
+    set_error_stream(NULL);
+    fclose(errors);
+    return code;
+}
+
+static char* eval_text(jmp_buf trap, const struct sexp* env, const char* s) {
+    return text(eval_string(trap, env, s, strlen(s)).exp);
+}
+
+int main() {
+    unsigned ok = 0, ng = 0;
+    unsigned calls = 0;
+    jmp_buf trap;
+    char* p;
+
+    if (setjmp(trap)) {
+        NOT_REACHED_HERE();
+        return 1;
+    }
+    const struct sexp* env = define(NIL(), "t", symbol("True"));
+
+    /* definitions made by a string are kept; the value of the last expression is returned. */
+    static const char program[] = "(set (quote square) (lambda (x) (* x x))) (square 7)";
+    const struct env_exp r = eval_string(trap, env, program, sizeof(program) - 1);
+    ASSERT_EQ("49", name_of(r.exp));
+    env = r.env;
+    ASSERT_EQ("()", (p = eval_text(trap, env, ""))); free(p);
+
+    /* results are walked by the accessors. */
+    const struct sexp* x = eval_string(trap, env, "(quote (a 1 (b)))", 17).exp;
+    ASSERT_EQ("a", is_symbol(fst(x)) ? name_of(fst(x)) : "other");
+    ASSERT_EQ("1", is_fixnum(fst(snd(x))) ? name_of(fst(snd(x))) : "other");
+    ASSERT_EQ("b", name_of(fst(fst(snd(snd(x))))));
+
+    /* native functions are called by the tree walker and from compiled lambdas, memo and pmap. */
+    env = define(env, "sum", native("sum", -1, sum, &calls));
+    env = define(env, "pair", native("pair", 2, pair, NULL));
+    ASSERT_EQ("True", is_applicable(eval_string(trap, env, "sum", 3).exp) ? "True" : "other");
+    ASSERT_EQ("10", (p = eval_text(trap, env, "(sum 1 2 3 4)"))); free(p);
+    ASSERT_EQ("0", (p = eval_text(trap, env, "(sum)"))); free(p);
+    ASSERT_EQ("(a: 3)", (p = eval_text(trap, env, "((lambda (x) (pair (quote a) (sum x 1))) 2)"))); free(p);
+    ASSERT_EQ("(5 5)", (p = eval_text(trap, env, "(set (quote m) (memo sum)) (cons (m 2 3) (cons (m 2 3) ()))"))); free(p);
+    ASSERT_EQ("4", calls == 4 ? "4" : "other");
+    ASSERT_EQ("(1 2 3)", (p = eval_text(trap, env, "(pmap sum (quote (1 2 3)) 1)"))); free(p);
+
+    /* wrong number of arguments, and errors thrown by native functions. */
+    ASSERT_EQ("TRAP_ILLARG", fail(env, "(pair 1)", &p) == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+    ASSERT_EQ("List length mismatch.", p); free(p);
+    ASSERT_EQ("TRAP_ILLARG", fail(env, "(sum 1 (quote a))", &p) == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+    ASSERT_EQ("`a` is not number.", p); free(p);
+
+    /* native functions in image are taken from those made by their names in this process. */
+    static const char path[] = "/tmp/ulisp-test-lib.img";
+    if (!save_image(path, define(env, "twice", eval_string(trap, env, "(lambda (x) (sum x x))", 22).exp))) {
+        NOT_REACHED_HERE();
+    }
+    const struct sexp* loaded;
+    if (!load_image(path, &loaded)) {
+        NOT_REACHED_HERE();
+        loaded = env;
+    }
+    remove(path);
+    ASSERT_EQ("4", (p = eval_text(trap, loaded, "(twice 2)"))); free(p);
+    ASSERT_EQ("8", calls == 8 ? "8" : "other"); /* 3 by pmap, 1 by twice. */
+
+    release_interpreter();
+    printf("total %d run, NG = %d\n", ok + ng, ng);
+    return -ng;
+}
@@ -23,16 +23,16 @@ int main() {
         ASSERT_FAIL("NOT REACHED HERE");
     } else {
         char hello[] = "((hello)\\\nworld)\\(\\:hello\\\\\\ world\\:\\)";
-        FILE* fp = fmemopen(hello, sizeof(hello), "r");
-        ASSERT_EQ("(",     (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ("(",     (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ("hello", (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ(")",     (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ("world", (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ(")",     (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ("(:hello\\ world:)", (p = fgettoken(trap, fp))); free(p);
-        ASSERT_EQ("",      (p = fgettoken(trap, fp))); free(p);
-        fclose(fp);
+        struct source* source = string_source(hello, sizeof(hello));
+        ASSERT_EQ("(",     gettoken(trap, source));
+        ASSERT_EQ("(",     gettoken(trap, source));
+        ASSERT_EQ("hello", gettoken(trap, source));
+        ASSERT_EQ(")",     gettoken(trap, source));
+        ASSERT_EQ("world", gettoken(trap, source));
+        ASSERT_EQ(")",     gettoken(trap, source));
+        ASSERT_EQ("(:hello\\ world:)", gettoken(trap, source));
+        ASSERT_EQ("",      gettoken(trap, source));
+        close_source(source);
     }
 
     if (setjmp(trap)) {
@@ -47,6 +47,86 @@ int main() {
         stdin = fp;
     }
 
+    if (setjmp(trap)) {
+        ASSERT_FAIL("NOT REACHED HERE");
+    } else {
+        /* tokens across refills of buffer: (x0 x1 ... x19999) is longer than the buffer. */
+        FILE* fp = open_memstream(&p, &(size_t){0});
+        unsigned i;
+        fprintf(fp, "(");
+        for (i = 0; i < 20000; ++i) {
+            fprintf(fp, "x%u ", i);
+        }
+        fprintf(fp, ")");
+        fclose(fp);
+        fp = fmemopen(p, strlen(p), "r");
+        struct source* source = open_source(fp);
+        const struct sexp* x = read_source(trap, source);
+        for (i = 0; !nil(snd(x)); ++i) {
+            x = snd(x);
+        }
+        ASSERT_EQ("x19999", name_of(fst(x)));
+        close_source(source);
+        fclose(fp);
+        free(p);
+    }
+
+    {
+        /* regular file is mapped and read to its end. */
+        FILE* fp = tmpfile();
+        fprintf(fp, "(a: b)\n(c d)\n");
+        rewind(fp);
+        struct source* source = open_source(fp);
+        ASSERT_EQ("mapped", source->map ? "mapped" : "buffered");
+        switch (setjmp(trap)) {
+        case TRAP_NONE:
+            ASSERT_EQ("(a: b)", (p = text(read_source(trap, source)))); free(p);
+            ASSERT_EQ("(c d)", (p = text(read_source(trap, source)))); free(p);
+            read_source(trap, source);
+            ASSERT_FAIL("NOT REACHED HERE");
+            break;
+        case TRAP_NOINPUT:
+            ok += 1;
+            break;
+        default:
+            ASSERT_FAIL("NOT REACHED HERE");
+            break;
+        }
+        close_source(source);
+        fclose(fp);
+    }
+
+    if (setjmp(trap)) {
+        ASSERT_FAIL("NOT REACHED HERE");
+    } else {
+        /* numerals are read as fixnums, and others as symbols. */
+        char numerals[] = "(0 -12 4611686018427387903 - 1a -x)";
+        struct source* source = string_source(numerals, sizeof(numerals));
+        const struct sexp* x = read_source(trap, source);
+        ASSERT_EQ("(0 -12 4611686018427387903 - 1a -x)", (p = text(x))); free(p);
+        ASSERT_EQ("fixnum", is_fixnum(fst(snd(x))) && fixnum_value(fst(snd(x))) == -12 ? "fixnum" : "symbol");
+        ASSERT_EQ("symbol", is_fixnum(fst(snd(snd(snd(x))))) ? "fixnum" : "symbol");
+        close_source(source);
+    }
+
+    {
+        /* numeral out of range of fixnum is an error. */
+        char numeral[] = "4611686018427387904";
+        struct source* source = string_source(numeral, sizeof(numeral));
+        FILE* fp = stderr;
+        stderr = open_memstream(&p, &(size_t){0});
+        const int code = setjmp(trap);
+        if (code == TRAP_NONE) {
+            read_source(trap, source);
+        }
+        fclose(stderr);
+        stderr = fp;
+        ASSERT_EQ("TRAP_ILLARG", code == TRAP_ILLARG ? "TRAP_ILLARG" : "other");
+        ASSERT_EQ("Integer out of range: 4611686018427387904", p);
+        free(p);
+        close_source(source);
+    }
+
     printf("Total %d run, NG = %d\n", ok + ng, ng);
     return -ng;
 }
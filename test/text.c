@@ -36,6 +36,38 @@ int main() {
     ASSERT_EQ("((x: 1) (y: 2))", str);
     free(str);
 
+    { /* long and deeply nested lists are written without recursion. */
+        const struct sexp* xs = NIL();
+        const struct sexp* ys = NIL();
+        unsigned i;
+        for (i = 0; i < 1000000; ++i) {
+            xs = cons(symbol("x"), xs);
+            ys = cons(ys, NIL());
+        }
+        str = text(xs);
+        ASSERT_EQ(" x x)", str + strlen(str) - 5);
+        ASSERT_EQ("(x x ", (str[5] = '\0', str));
+        free(str);
+        str = text(ys);
+        ASSERT_EQ("))))", str + strlen(str) - 4);
+        ASSERT_EQ("((((", (str[4] = '\0', str));
+        free(str);
+    }
+
+    set_print_limits(2, 0);
+    str = text(cons(symbol("a"), cons(symbol("b"), cons(symbol("c"), NIL()))));
+    ASSERT_EQ("(a b ...)", str);
+    free(str);
+    str = text(cons(symbol("a"), cons(symbol("b"), symbol("c"))));
+    ASSERT_EQ("(a b: c)", str);
+    free(str);
+
+    set_print_limits(0, 2);
+    str = text(cons(symbol("a"), cons(cons(symbol("b"), cons(cons(symbol("c"), NIL()), NIL())), NIL())));
+    ASSERT_EQ("(a (b #))", str);
+    free(str);
+    set_print_limits(0, 0);
+
     printf("total %d run, NG = %d\n", ok + ng, ng);
     return -ng;
 }
\ No newline at end of file